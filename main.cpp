@@ -4,20 +4,3518 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <unordered_map>
+#include <map>
+#include <unordered_set>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
 #include <regex>
 #include <cstdlib>
 #include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <linux/fs.h>
+#include <unistd.h>
 #include <uuid/uuid.h>
 #include <curl/curl.h>
 
 namespace fs = std::filesystem;
 
+static void jsonEscape(std::string& out, const std::string& s) {
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+}
+
+// Top-level string field of a flat JSON object; "" when absent or not a
+// string. Enough for yt-dlp's --dump-json lines, not a general parser.
+static std::string jsonString(const std::string& json, const std::string& key) {
+    std::string needle = "\"" + key + "\"";
+    size_t pos = 0;
+    int depth = 0;
+    bool inString = false;
+    // Walk the text so nested objects and string contents can't match.
+    for (size_t i = 0; i < json.size(); i++) {
+        char c = json[i];
+        if (inString) {
+            if (c == '\\') i++;
+            else if (c == '"') inString = false;
+            continue;
+        }
+        if (c == '{' || c == '[') depth++;
+        else if (c == '}' || c == ']') depth--;
+        else if (c == '"') {
+            if (depth == 1 && json.compare(i, needle.size(), needle) == 0) {
+                pos = json.find_first_not_of(" \t", i + needle.size());
+                if (pos != std::string::npos && json[pos] == ':') break;
+            }
+            inString = true;
+        }
+        pos = 0;
+    }
+    if (pos == 0) return "";
+    pos = json.find_first_not_of(" \t", pos + 1);
+    if (pos == std::string::npos || json[pos] != '"') return "";
+    std::string value;
+    for (size_t i = pos + 1; i < json.size(); i++) {
+        char c = json[i];
+        if (c == '"') return value;
+        if (c != '\\' || i + 1 >= json.size()) {
+            value += c;
+            continue;
+        }
+        char e = json[++i];
+        switch (e) {
+            case 'n': value += '\n'; break;
+            case 't': value += '\t'; break;
+            case 'r': value += '\r'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'u': {
+                unsigned code = i + 4 < json.size() ? std::strtoul(json.substr(i + 1, 4).c_str(), nullptr, 16) : '?';
+                i += 4;
+                if (code < 0x80) {
+                    value += static_cast<char>(code);
+                } else if (code < 0x800) {
+                    value += static_cast<char>(0xC0 | (code >> 6));
+                    value += static_cast<char>(0x80 | (code & 0x3F));
+                } else {
+                    value += static_cast<char>(0xE0 | (code >> 12));
+                    value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    value += static_cast<char>(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default: value += e;
+        }
+    }
+    return "";
+}
+
+static std::string urlHost(const std::string& url) {
+    std::string host;
+    CURLU* u = curl_url();
+    char* part = nullptr;
+    if (curl_url_set(u, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK &&
+        curl_url_get(u, CURLUPART_HOST, &part, 0) == CURLUE_OK) {
+        host = part;
+        curl_free(part);
+    }
+    curl_url_cleanup(u);
+    return host;
+}
+
+// Extension for downloaded image data: the magic bytes of its first chunk
+// win, then the Content-Type; .jpg when neither is recognised.
+static std::string imageExtension(const std::string& head, const std::string& contentType) {
+    auto starts = [&head](const char* magic, size_t len, size_t at = 0) {
+        return head.size() >= at + len && head.compare(at, len, magic, len) == 0;
+    };
+    if (starts("\xFF\xD8\xFF", 3)) return ".jpg";
+    if (starts("\x89PNG", 4)) return ".png";
+    if (starts("GIF8", 4)) return ".gif";
+    if (starts("RIFF", 4) && starts("WEBP", 4, 8)) return ".webp";
+    if (starts("ftypavif", 8, 4) || starts("ftypavis", 8, 4)) return ".avif";
+    if (starts("ftypheic", 8, 4) || starts("ftypmif1", 8, 4)) return ".heic";
+    if (starts("II*\0", 4) || starts("MM\0*", 4)) return ".tif";
+    if (starts("\0\0\1\0", 4)) return ".ico";
+    if (starts("BM", 2)) return ".bmp";
+    if (head.find("<svg") != std::string::npos) return ".svg";
+
+    std::string type;
+    for (char c : contentType.substr(0, contentType.find(';')))
+        if (c != ' ') type += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    static const std::map<std::string, std::string> types = {
+        {"image/jpeg", ".jpg"}, {"image/png", ".png"}, {"image/gif", ".gif"}, {"image/webp", ".webp"},
+        {"image/avif", ".avif"}, {"image/heic", ".heic"}, {"image/tiff", ".tif"}, {"image/bmp", ".bmp"},
+        {"image/svg+xml", ".svg"}, {"image/x-icon", ".ico"}, {"image/vnd.microsoft.icon", ".ico"}};
+    auto it = types.find(type);
+    return it != types.end() ? it->second : ".jpg";
+}
+
+static std::string fileHead(const std::string& path, size_t len = 64) {
+    std::ifstream in(path, std::ios::binary);
+    std::string head(len, '\0');
+    in.read(&head[0], static_cast<std::streamsize>(len));
+    head.resize(static_cast<size_t>(in.gcount()));
+    return head;
+}
+
+// Nearest-rank percentile (pct in 0-100) of a non-empty sample; reorders it.
+static double percentile(std::vector<double>& values, double pct) {
+    size_t rank = static_cast<size_t>(std::ceil(pct / 100 * values.size()));
+    auto nth = values.begin() + static_cast<std::ptrdiff_t>(std::min(std::max<size_t>(rank, 1), values.size()) - 1);
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+// "1.50 MB"-style size; whole bytes below 1 KB.
+static std::string formatBytes(double bytes, int precision = 2) {
+    const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+    int i = 0;
+    while (bytes >= 1024 && i < 4) {
+        bytes /= 1024;
+        i++;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(i == 0 ? 0 : precision) << bytes << " " << units[i];
+    return out.str();
+}
+
+enum class LogLevel { Info, Ok, Err, Yt, Progress, Warn, System };
+
+// Asynchronous logger: producers claim a slot in a bounded multi-producer
+// ring (Vyukov-style sequence numbers, no locks) and a single consumer
+// thread batches terminal and JSON-lines output. When the ring is full the
+// entry is dropped and counted instead of blocking the caller.
+class AsyncLogger {
+private:
+    static constexpr size_t capacity = 1 << 13;
+
+    struct Slot {
+        std::atomic<size_t> seq{0};
+        LogLevel level = LogLevel::Info;
+        int64_t micros = 0;
+        std::string msg;
+    };
+
+    std::unique_ptr<Slot[]> ring;
+    std::atomic<size_t> head{0};
+    size_t tail = 0;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> stopping{false};
+
+    const bool interactive = isatty(STDOUT_FILENO);
+    std::mutex statusMutex;
+    std::string status;
+    bool statusDirty = false;
+    bool statusShown = false;
+    std::ofstream json;
+    std::thread consumer;
+
+    static const char* color(LogLevel level) {
+        switch (level) {
+            case LogLevel::Ok: return "\033[1;32m[✔] ";
+            case LogLevel::Err: return "\033[1;31m[✘] ";
+            case LogLevel::Yt: return "\033[1;35m[YT] ";
+            case LogLevel::Progress: return "\033[1;34m[⇣] ";
+            case LogLevel::Warn: return "\033[1;33m[!] ";
+            case LogLevel::System: return "\033[1;36m[*] ";
+            default: return "\033[1;34m[*] ";
+        }
+    }
+
+    static const char* name(LogLevel level) {
+        switch (level) {
+            case LogLevel::Ok: return "ok";
+            case LogLevel::Err: return "error";
+            case LogLevel::Yt: return "yt";
+            case LogLevel::Progress: return "progress";
+            case LogLevel::Warn: return "warn";
+            case LogLevel::System: return "system";
+            default: return "info";
+        }
+    }
+
+    bool pop(Slot*& slot) {
+        slot = &ring[tail & (capacity - 1)];
+        return slot->seq.load(std::memory_order_acquire) == tail + 1;
+    }
+
+    // Drains whatever is queued into one stdout and one stderr write.
+    bool flush() {
+        std::string out, err, lines;
+        Slot* slot = nullptr;
+        size_t taken = 0;
+        while (taken < capacity && pop(slot)) {
+            std::string& target = slot->level == LogLevel::Err ? err : out;
+            target += color(slot->level);
+            target += slot->msg;
+            target += "\033[0m\n";
+            if (json.is_open()) {
+                lines += "{\"ts\":" + std::to_string(slot->micros / 1000000) + "." +
+                         std::to_string(1000000 + slot->micros % 1000000).substr(1) + ",\"level\":\"" +
+                         name(slot->level) + "\",\"msg\":\"";
+                jsonEscape(lines, slot->msg);
+                lines += "\"}\n";
+            }
+            slot->msg.clear();
+            slot->seq.store(tail + capacity, std::memory_order_release);
+            tail++;
+            taken++;
+        }
+
+        std::string line;
+        bool changed = false;
+        {
+            std::lock_guard<std::mutex> lock(statusMutex);
+            changed = statusDirty;
+            statusDirty = false;
+            line = status;
+        }
+        if (interactive) {
+            // Lift the status line off, print the batch, then put it back.
+            bool redraw = changed || (taken > 0 && statusShown);
+            if (redraw && statusShown) {
+                std::cout << "\r\033[K";
+                statusShown = false;
+            }
+            if (!err.empty()) {
+                std::cout << std::flush;
+                std::cerr << err << std::flush;
+            }
+            std::cout << out;
+            if (redraw && !line.empty()) {
+                std::cout << color(LogLevel::Progress) << line << "\033[0m";
+                statusShown = true;
+            }
+        } else {
+            if (!err.empty()) std::cerr << err << std::flush;
+            std::cout << out;
+            if (changed && !line.empty()) std::cout << color(LogLevel::Progress) << line << "\033[0m\n";
+        }
+        std::cout << std::flush;
+        if (!lines.empty()) json << lines << std::flush;
+        return taken > 0;
+    }
+
+    void run() {
+        int idle = 0;
+        while (true) {
+            bool busy = flush();
+            if (!busy && stopping) break;
+            if (busy) {
+                idle = 0;
+                continue;
+            }
+            // Back off up to 5ms when nothing is queued; producers never wait on us.
+            std::this_thread::sleep_for(std::chrono::microseconds(idle < 10 ? 200 : 5000));
+            idle++;
+        }
+    }
+
+public:
+    AsyncLogger() : ring(new Slot[capacity]) {
+        for (size_t i = 0; i < capacity; i++) ring[i].seq.store(i, std::memory_order_relaxed);
+        consumer = std::thread([this] { run(); });
+    }
+
+    ~AsyncLogger() {
+        stopping = true;
+        consumer.join();
+        if (interactive && statusShown) std::cout << "\r\033[K" << std::flush;
+        uint64_t lost = dropped;
+        if (lost > 0) std::cerr << color(LogLevel::Warn) << lost << " log dibuang (buffer penuh)\033[0m\n";
+    }
+
+    void openJson(const std::string& path) {
+        json.open(path, std::ios::app);
+    }
+
+    bool isInteractive() const { return interactive; }
+
+    void push(LogLevel level, const std::string& msg) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot = nullptr;
+        while (true) {
+            slot = &ring[pos & (capacity - 1)];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->level = level;
+        slot->micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::system_clock::now().time_since_epoch()).count();
+        slot->msg = msg;
+        slot->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    // The status line is a single overwritten value, drawn by the consumer.
+    void setStatus(const std::string& line) {
+        std::lock_guard<std::mutex> lock(statusMutex);
+        status = line;
+        statusDirty = true;
+    }
+
+    uint64_t droppedCount() const { return dropped; }
+};
+
+struct Job {
+    std::string mode;
+    std::string url;
+    std::string quality;
+    std::string path;
+    std::string name;  // fixed output basename (daemon jobs), random when empty
+};
+
+struct DownloadResult {
+    bool ok = false;
+    std::string file;
+    uintmax_t bytes = 0;
+};
+
+// Fixed-size thread pool; submit() never blocks, wait() drains the queue.
+class WorkerPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable taskCv;
+    std::condition_variable idleCv;
+    size_t busy = 0;
+    bool stopping = false;
+
+    void loop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                taskCv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                busy++;
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                busy--;
+                if (tasks.empty() && busy == 0) idleCv.notify_all();
+            }
+        }
+    }
+
+public:
+    explicit WorkerPool(size_t size) {
+        if (size == 0) size = 1;
+        for (size_t i = 0; i < size; i++)
+            workers.emplace_back([this] { loop(); });
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        taskCv.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            tasks.push_back(std::move(task));
+        }
+        taskCv.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        idleCv.wait(lock, [this] { return tasks.empty() && busy == 0; });
+    }
+
+    size_t size() const { return workers.size(); }
+};
+
+// Process-wide curl state: one share handle for DNS and TLS sessions, plus
+// idle easy handles kept per host so repeat jobs skip the handshake. Live
+// connections are not shared: handles run on several threads at once (the
+// image engine, fragment fetchers, blocking fetches), which libcurl's
+// connection-cache sharing doesn't support. Each multi handle reuses its own
+// connections, and an idle easy handle keeps its cache across reset.
+// Owns curl_global_init/cleanup.
+class ConnectionPool {
+private:
+    static constexpr size_t maxIdlePerHost = 32;
+
+    CURLSH* share = nullptr;
+    std::mutex locks[CURL_LOCK_DATA_LAST];
+    std::mutex idleMutex;
+    std::unordered_map<std::string, std::vector<CURL*>> idle;
+    std::atomic<long> connects{0};
+    std::atomic<long> reused{0};
+
+    static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* self) {
+        static_cast<ConnectionPool*>(self)->locks[data].lock();
+    }
+
+    static void unlockShare(CURL*, curl_lock_data data, void* self) {
+        static_cast<ConnectionPool*>(self)->locks[data].unlock();
+    }
+
+    ConnectionPool() {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    ~ConnectionPool() {
+        for (auto& entry : idle)
+            for (CURL* easy : entry.second) curl_easy_cleanup(easy);
+        curl_share_cleanup(share);
+        curl_global_cleanup();
+    }
+
+public:
+    static ConnectionPool& instance() {
+        static ConnectionPool pool;
+        return pool;
+    }
+
+    // Returns a clean handle already attached to the share.
+    CURL* acquire(const std::string& host) {
+        CURL* easy = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            auto it = idle.find(host);
+            if (it != idle.end() && !it->second.empty()) {
+                easy = it->second.back();
+                it->second.pop_back();
+            }
+        }
+        if (!easy) easy = curl_easy_init();
+        if (easy) curl_easy_setopt(easy, CURLOPT_SHARE, share);
+        return easy;
+    }
+
+    void release(const std::string& host, CURL* easy) {
+        if (!easy) return;
+        long count = 0;
+        if (curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &count) == CURLE_OK) {
+            connects += count;
+            if (count == 0) reused++;
+        }
+        curl_easy_reset(easy);
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            auto& handles = idle[host];
+            if (handles.size() < maxIdlePerHost) {
+                handles.push_back(easy);
+                return;
+            }
+        }
+        curl_easy_cleanup(easy);
+    }
+
+    long newConnections() const { return connects; }
+    long reusedConnections() const { return reused; }
+};
+
+// curl's timings: each is an offset from the start of the transfer, so
+// they accumulate. The *Phase() helpers give the time spent in one phase.
+struct TransferTimes {
+    double dns = 0;
+    double connect = 0;
+    double tls = 0;
+    double ttfb = 0;
+    double total = 0;
+
+    double connectPhase() const { return std::max(0.0, connect - dns); }
+    // 0 for plain HTTP and for reused connections.
+    double tlsPhase() const { return tls > 0 ? std::max(0.0, tls - connect) : 0; }
+    double waitPhase() const { return std::max(0.0, ttfb - std::max(tls, connect)); }
+    double transferPhase() const { return std::max(0.0, total - ttfb); }
+};
+
+struct FetchResult {
+    bool ok = false;
+    bool notModified = false;
+    std::string filename;
+    std::string error;
+    std::string etag;
+    std::string modified;
+    uintmax_t bytes = 0;
+    double seconds = 0;
+    bool hasTimes = false;
+    TransferTimes times;
+    bool hedged = false;
+    bool hedgeWon = false;
+};
+
+struct ImageTask {
+    std::string url;
+    std::string filename;
+    std::string partname;
+    // Replace filename's extension with the one the data turns out to have.
+    bool detectType = false;
+    std::function<void(const FetchResult&)> done;
+    std::string etag;
+    std::string modified;
+};
+
+struct FileSink;
+
+// Process-wide disk writer: transfers copy incoming data into large aligned
+// buffers and hand full ones to this thread, so the network loop never
+// waits on write(2). The buffer pool is bounded; when the disk falls that
+// far behind, producers block until a buffer comes back.
+class DiskWriter {
+public:
+    static constexpr size_t bufferSize = 1 << 20;
+    static constexpr size_t alignment = 4096;
+
+private:
+    static constexpr size_t maxBuffers = 64;
+
+    struct Op {
+        FileSink* sink;
+        int fd;
+        off_t offset;
+        char* buf;
+        size_t len;
+        std::function<void(bool)> done;  // set on the marker notify() queues instead of a buffer
+    };
+
+    std::mutex mtx;
+    std::condition_variable workCv;
+    std::condition_variable doneCv;
+    std::condition_variable freeCv;
+    std::deque<Op> ops;
+    std::vector<char*> freeBuffers;
+    size_t allocated = 0;
+    bool stopping = false;
+    std::thread thread;
+
+public:
+    static bool writeAll(int fd, const char* data, size_t len, off_t offset) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pwrite(fd, data + done, len - done, offset + static_cast<off_t>(done));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+private:
+    void loop();
+
+    DiskWriter() { thread = std::thread([this] { loop(); }); }
+
+    ~DiskWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        workCv.notify_all();
+        thread.join();
+        for (char* buf : freeBuffers) free(buf);
+    }
+
+public:
+    static DiskWriter& instance() {
+        static DiskWriter writer;
+        return writer;
+    }
+
+    // Returns an aligned buffer of bufferSize bytes, or nullptr if the
+    // allocation failed.
+    char* acquire() {
+        std::unique_lock<std::mutex> lock(mtx);
+        freeCv.wait(lock, [this] { return !freeBuffers.empty() || allocated < maxBuffers; });
+        if (!freeBuffers.empty()) {
+            char* buf = freeBuffers.back();
+            freeBuffers.pop_back();
+            return buf;
+        }
+        void* buf = nullptr;
+        if (posix_memalign(&buf, alignment, bufferSize) != 0) return nullptr;
+        allocated++;
+        return static_cast<char*>(buf);
+    }
+
+    void release(char* buf) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            freeBuffers.push_back(buf);
+        }
+        freeCv.notify_one();
+    }
+
+    void submit(FileSink* sink, int fd, off_t offset, char* buf, size_t len);
+    void drain(FileSink* sink);
+    // Calls done(ok) on this thread once everything submitted for sink so
+    // far has been written.
+    void notify(FileSink* sink, std::function<void(bool)> done);
+};
+
+// Sequential writer for one stream of bytes into a file starting at a given
+// offset. Full buffers go to the DiskWriter thread; finish() flushes the
+// tail and waits for them, finishAsync() hands the tail over as well and
+// hears back from that thread instead. With a directFd (O_DIRECT) every write that is
+// aligned in both offset and length bypasses the page cache: the first
+// buffer is cut short so the rest start on a block boundary, and only the
+// unaligned head and tail go through the ordinary fd.
+struct FileSink {
+    int fd;
+    int directFd;
+    off_t next;
+    char* buf = nullptr;
+    size_t used = 0;
+    size_t cap = 0;
+    std::atomic<size_t> queued{0};
+    std::atomic<off_t> durable;
+    std::atomic<bool> failed{false};
+
+    FileSink(int fd, int directFd, off_t offset) : fd(fd), directFd(directFd), next(offset), durable(offset) {}
+
+    ~FileSink() {
+        if (buf) DiskWriter::instance().release(buf);
+    }
+
+    bool write(const char* data, size_t len) {
+        while (len > 0) {
+            if (!buf) {
+                buf = DiskWriter::instance().acquire();
+                if (!buf) return false;
+                used = 0;
+                cap = DiskWriter::bufferSize - static_cast<size_t>(next % DiskWriter::alignment);
+            }
+            size_t n = std::min(len, cap - used);
+            memcpy(buf + used, data, n);
+            used += n;
+            data += n;
+            len -= n;
+            if (used == cap) handOff();
+        }
+        return !failed;
+    }
+
+    // Flushes everything and reports whether all of it reached the file.
+    bool finish() {
+        DiskWriter& writer = DiskWriter::instance();
+        if (buf && used > 0 && queued == 0 && !directAligned()) {
+            // Small files never leave the caller's thread.
+            if (!DiskWriter::writeAll(fd, buf, used, next)) failed = true;
+            next += static_cast<off_t>(used);
+            durable = next;
+            writer.release(buf);
+            buf = nullptr;
+        } else if (buf && used > 0) {
+            handOff();
+        }
+        writer.drain(this);
+        if (buf) {
+            writer.release(buf);
+            buf = nullptr;
+        }
+        return !failed;
+    }
+
+    // For callers that must not block, e.g. a network loop.
+    void finishAsync(std::function<void(bool)> done) {
+        if (buf && used > 0) {
+            handOff();
+        } else if (buf) {
+            DiskWriter::instance().release(buf);
+            buf = nullptr;
+        }
+        DiskWriter::instance().notify(this, std::move(done));
+    }
+
+private:
+    bool directAligned() const {
+        return directFd >= 0 && next % DiskWriter::alignment == 0 && used % DiskWriter::alignment == 0;
+    }
+
+    void handOff() {
+        DiskWriter::instance().submit(this, directAligned() ? directFd : fd, next, buf, used);
+        next += static_cast<off_t>(used);
+        buf = nullptr;
+    }
+};
+
+inline void DiskWriter::submit(FileSink* sink, int fd, off_t offset, char* buf, size_t len) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        ops.push_back({sink, fd, offset, buf, len, {}});
+        sink->queued++;
+    }
+    workCv.notify_one();
+}
+
+inline void DiskWriter::drain(FileSink* sink) {
+    std::unique_lock<std::mutex> lock(mtx);
+    doneCv.wait(lock, [sink] { return sink->queued == 0; });
+}
+
+inline void DiskWriter::notify(FileSink* sink, std::function<void(bool)> done) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        ops.push_back({sink, -1, 0, nullptr, 0, std::move(done)});
+    }
+    workCv.notify_one();
+}
+
+inline void DiskWriter::loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        workCv.wait(lock, [this] { return stopping || !ops.empty(); });
+        if (ops.empty()) return;
+        Op op = std::move(ops.front());
+        ops.pop_front();
+        lock.unlock();
+        if (!op.buf) {
+            // Everything queued before the marker is already written.
+            op.done(!op.sink->failed);
+            lock.lock();
+            continue;
+        }
+        // Ops of one sink run in order, so what is written is a prefix.
+        bool ok = !op.sink->failed && writeAll(op.fd, op.buf, op.len, op.offset);
+        if (ok) op.sink->durable = op.offset + static_cast<off_t>(op.len);
+        else op.sink->failed = true;
+        lock.lock();
+        freeBuffers.push_back(op.buf);
+        op.sink->queued--;
+        freeCv.notify_one();
+        doneCv.notify_all();
+    }
+}
+
+enum class TrafficClass { Image, Audio, Video };
+
+// Splits a global bandwidth cap (bytes/s, 0 = unlimited) between traffic
+// classes by weight, images first, then among the running streams of each
+// class. curl transfers are re-tuned through CURLOPT_MAX_RECV_SPEED_LARGE
+// whenever the split changes; a yt-dlp child can't be, so it reserves its
+// --limit-rate once at spawn and curl shares what is left.
+class BandwidthScheduler {
+private:
+    static constexpr curl_off_t minShare = 16 << 10;
+
+    struct ClassState {
+        size_t demand = 0;
+        size_t running = 0;
+    };
+
+    struct Pending {
+        TrafficClass traffic;
+        std::function<void(curl_off_t)> granted;
+    };
+
+    using Grants = std::vector<std::pair<std::function<void(curl_off_t)>, curl_off_t>>;
+
+    mutable std::mutex mtx;
+    std::deque<Pending> pending;
+    curl_off_t rate = 0;
+    curl_off_t reserved = 0;
+    ClassState classes[3];
+    std::atomic<uint64_t> changes{0};
+
+    static double weight(TrafficClass c) {
+        switch (c) {
+            case TrafficClass::Image: return 4;
+            case TrafficClass::Audio: return 2;
+            default: return 1;
+        }
+    }
+
+    ClassState& state(TrafficClass c) { return classes[static_cast<int>(c)]; }
+
+    curl_off_t classShare(TrafficClass c) const {
+        double total = weight(c);
+        for (int i = 0; i < 3; i++) {
+            TrafficClass other = static_cast<TrafficClass>(i);
+            if (other != c && (classes[i].demand > 0 || classes[i].running > 0)) total += weight(other);
+        }
+        return static_cast<curl_off_t>(static_cast<double>(rate) * weight(c) / total);
+    }
+
+    // Caller holds mtx; the callbacks in ready run after it is released.
+    void grantPending(Grants& ready) {
+        while (!pending.empty() && (rate == 0 || reserved == 0 || rate - reserved >= minShare)) {
+            TrafficClass c = pending.front().traffic;
+            state(c).running++;
+            changes++;
+            curl_off_t per = 0;
+            if (rate > 0) {
+                curl_off_t left = rate - reserved;
+                per = std::min(classShare(c) / static_cast<curl_off_t>(state(c).running), left);
+                per = std::min(std::max(per, minShare), left);
+                reserved += per;
+            }
+            ready.push_back({std::move(pending.front().granted), per});
+            pending.pop_front();
+        }
+    }
+
+    BandwidthScheduler() = default;
+
+public:
+    static BandwidthScheduler& instance() {
+        static BandwidthScheduler scheduler;
+        return scheduler;
+    }
+
+    void setRate(curl_off_t bytesPerSecond) {
+        Grants ready;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            rate = bytesPerSecond > 0 ? bytesPerSecond : 0;
+            changes++;
+            grantPending(ready);
+        }
+        for (auto& g : ready) g.first(g.second);
+    }
+
+    bool limited() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return rate > 0;
+    }
+
+    // Queued work counts towards its class's weight before it starts, so a
+    // batch that lists images claims their share ahead of the videos.
+    void want(TrafficClass c) {
+        std::lock_guard<std::mutex> lock(mtx);
+        state(c).demand++;
+        changes++;
+    }
+
+    void satisfied(TrafficClass c) {
+        std::lock_guard<std::mutex> lock(mtx);
+        state(c).demand--;
+        changes++;
+    }
+
+    void start(TrafficClass c) {
+        std::lock_guard<std::mutex> lock(mtx);
+        state(c).running++;
+        changes++;
+    }
+
+    void stop(TrafficClass c) {
+        std::lock_guard<std::mutex> lock(mtx);
+        state(c).running--;
+        changes++;
+    }
+
+    // Current per-stream rate for a running stream of this class, 0 when
+    // unlimited. The minShare floor only applies while every stream still
+    // fits under the cap; past that they crawl rather than overshoot it.
+    curl_off_t share(TrafficClass c) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (rate == 0) return 0;
+        curl_off_t running = static_cast<curl_off_t>(std::max<size_t>(classes[static_cast<int>(c)].running, 1));
+        curl_off_t left = std::max<curl_off_t>(rate - reserved, 0);
+        curl_off_t per = std::min(classShare(c), left) / running;
+        per = std::max(per, std::min(minShare, left / running));
+        return std::max<curl_off_t>(per, 1);  // 0 would mean unlimited to curl
+    }
+
+    // Fixed share for a stream that can't be re-tuned later, handed to
+    // granted (0 when unlimited). Never more than what is left of the cap:
+    // while less than minShare is left the request queues, and the
+    // unreserve() that frees room grants it on that caller's thread.
+    // Nothing blocks here, so the gate and supervisor threads can call it.
+    void reserve(TrafficClass c, std::function<void(curl_off_t)> granted) {
+        Grants ready;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            pending.push_back({c, std::move(granted)});
+            grantPending(ready);
+        }
+        for (auto& g : ready) g.first(g.second);
+    }
+
+    void unreserve(TrafficClass c, curl_off_t amount) {
+        Grants ready;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            state(c).running--;
+            reserved -= amount;
+            changes++;
+            grantPending(ready);
+        }
+        for (auto& g : ready) g.first(g.second);
+    }
+
+    uint64_t generation() const { return changes; }
+};
+
+// Event-driven image fetcher: one thread drives every transfer through a
+// curl multi handle, multiplexing over HTTP/2 where the server allows it.
+// Large files on servers that accept ranges are split into byte-range
+// segments that write into one preallocated file through FileSinks. Data
+// lands in a .part file (plus a .meta sidecar) that later attempts resume
+// from, and is renamed to the final name only once it is complete.
+class ImageEngine {
+private:
+    static constexpr curl_off_t minSegmentSize = 1 << 20;
+    static constexpr curl_off_t checkpointBytes = 1 << 20;
+    static constexpr size_t headBytes = 64;
+    // Hedging: the deadline is a percentile of recent first-byte times,
+    // with a fixed one until enough transfers have been seen.
+    static constexpr size_t hedgeSamples = 512;
+    static constexpr size_t hedgeWarmup = 20;
+    static constexpr double hedgeInitial = 1.0;
+
+    struct Transfer;
+
+    struct Fetch {
+        ImageTask task;
+        std::string host;
+        int fd = -1;
+        int directFd = -1;
+        curl_off_t length = -1;
+        std::string etag;
+        std::string modified;
+        std::string contentType;
+        std::string head;
+        bool acceptRanges = false;
+        std::vector<std::pair<curl_off_t, curl_off_t>> ranges;
+        curl_off_t sinceCheckpoint = 0;
+        size_t pending = 0;
+        bool failed = false;
+        bool discard = false;
+        bool notModified = false;
+        std::string error;
+        uintmax_t bytes = 0;
+        bool timed = false;
+        TransferTimes times;
+        std::chrono::steady_clock::time_point started;
+        bool raced = false;
+        bool hedgeWon = false;
+        Transfer* winner = nullptr;
+        std::vector<Transfer*> racers;
+    };
+
+    enum class Kind { Probe, Whole, Range };
+
+    struct Transfer {
+        Fetch* fetch = nullptr;
+        std::string url;
+        std::string host;
+        Kind kind = Kind::Whole;
+        bool hedge = false;
+        bool responded = false;
+        std::chrono::steady_clock::time_point launched;
+        std::chrono::steady_clock::time_point deadline;
+        // Seconds the fetch had already waited when a hedge was launched.
+        double lead = 0;
+        size_t range = 0;
+        curl_off_t offset = 0;
+        curl_off_t end = -1;
+        bool started = false;
+        long status = 0;
+        bool metered = false;
+        bool ok = false;
+        long code = 0;
+        bool written = true;
+        std::unique_ptr<FileSink> sink;
+        CURL* easy = nullptr;
+        curl_slist* headers = nullptr;
+        char errbuf[CURL_ERROR_SIZE] = {0};
+    };
+
+    CURLM* multi = nullptr;
+    size_t maxInFlight;
+    size_t maxPerHost;
+    size_t segments;
+    bool directIo;
+    double hedgePercentile;
+    std::vector<std::pair<std::string, std::vector<std::string>>> mirrors;
+    size_t mirrorTurn = 0;
+    std::deque<double> firstByte;
+    std::unordered_set<Transfer*> armed;
+    std::unordered_set<Fetch*> races;
+    size_t inFlight = 0;
+    bool rescan = false;
+    uint64_t tuned = 0;
+    std::unordered_set<Transfer*> metered;
+    std::unordered_map<std::string, size_t> hostInFlight;
+    std::unordered_map<std::string, std::deque<Transfer*>> waiting;
+    std::unordered_map<std::string, std::deque<Fetch*>> parked;
+    std::unordered_set<std::string> activeParts;
+    std::deque<Transfer*> failed;
+
+    std::mutex mtx;
+    std::condition_variable idleCv;
+    std::deque<Fetch*> incoming;
+    std::deque<Transfer*> flushed;
+    size_t outstanding = 0;
+    bool stopping = false;
+    std::thread loopThread;
+
+    static std::string metaName(const Fetch* f) { return f->task.partname + ".meta"; }
+
+    static void saveMeta(Fetch* f) {
+        std::string meta = metaName(f);
+        std::ofstream out(meta + ".tmp", std::ios::trunc);
+        out << "etag " << (f->etag.empty() ? "-" : f->etag) << "\n"
+            << "modified " << (f->modified.empty() ? "-" : f->modified) << "\n"
+            << "length " << f->length << "\n";
+        for (const auto& r : f->ranges) out << "range " << r.first << " " << r.second << "\n";
+        out.close();
+        if (out) fs::rename(meta + ".tmp", meta);
+        f->sinceCheckpoint = 0;
+    }
+
+    static bool loadMeta(Fetch* f) {
+        std::ifstream in(metaName(f));
+        if (!in) return false;
+        std::string key;
+        while (in >> key) {
+            if (key == "etag" || key == "modified") {
+                std::string value;
+                in >> std::ws;
+                std::getline(in, value);
+                if (value == "-") value.clear();
+                (key == "etag" ? f->etag : f->modified) = value;
+            } else if (key == "length") {
+                in >> f->length;
+            } else if (key == "range") {
+                curl_off_t next = 0, end = 0;
+                in >> next >> end;
+                f->ranges.emplace_back(next, end);
+            }
+        }
+        return !f->etag.empty() || !f->modified.empty();
+    }
+
+    static void dropPart(const Fetch* f) {
+        std::error_code ec;
+        fs::remove(f->task.partname, ec);
+        fs::remove(metaName(f), ec);
+    }
+
+    static size_t writeData(void* ptr, size_t size, size_t nmemb, Transfer* t) {
+        size_t len = size * nmemb;
+        Fetch* f = t->fetch;
+        // The losing half of a hedged pair is on its way out; swallow its body.
+        if (f->raced && f->winner != t) return len;
+        long code = 0;
+        curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &code);
+        if (t->kind == Kind::Range) {
+            if (code != 206 || t->offset + static_cast<curl_off_t>(len) > t->end + 1) return 0;
+        } else if (!t->started) {
+            // A 200 to a resume request means the server ignored Range or the
+            // validator no longer matches; start the part over.
+            if (t->offset > 0 && code != 206) {
+                if (ftruncate(f->fd, 0) != 0) return 0;
+                t->offset = 0;
+            }
+            saveMeta(f);
+            // Reserve the blocks up front without growing the file, so a
+            // resume still reads the part's size as the bytes it holds.
+            if (f->length > t->offset) fallocate(f->fd, FALLOC_FL_KEEP_SIZE, 0, f->length);
+        }
+        if (!t->sink) t->sink.reset(new FileSink(f->fd, f->directFd, t->offset));
+        t->started = true;
+        if (t->offset == 0 && f->head.empty()) f->head.assign(static_cast<const char*>(ptr), std::min(len, headBytes));
+        if (!t->sink->write(static_cast<const char*>(ptr), len)) return 0;
+        t->offset += static_cast<curl_off_t>(len);
+        if (t->kind == Kind::Range) {
+            // The checkpoint only covers what has reached the file.
+            f->ranges[t->range].first = t->sink->durable;
+            f->sinceCheckpoint += static_cast<curl_off_t>(len);
+            if (f->sinceCheckpoint >= checkpointBytes) saveMeta(f);
+        }
+        return len;
+    }
+
+    static size_t readHeader(char* buffer, size_t size, size_t nitems, Transfer* t) {
+        std::string line(buffer, size * nitems);
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) line.pop_back();
+        std::string lower;
+        for (char c : line) lower += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        Fetch* f = t->fetch;
+        t->responded = true;
+        if (f->raced && f->winner && f->winner != t) return size * nitems;
+        size_t colon = line.find(':');
+        std::string value = colon == std::string::npos ? "" : line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+
+        if (lower.rfind("http/", 0) == 0) {
+            size_t sp = line.find(' ');
+            t->status = sp == std::string::npos ? 0 : std::atol(line.c_str() + sp + 1);
+            if (t->kind == Kind::Probe) f->acceptRanges = false;
+            bool final = t->status == 200 || t->status == 206 || t->status == 304;
+            if (f->raced && !f->winner && final) {
+                // First final response of a hedged pair wins. Whatever the
+                // other one's redirects left behind doesn't describe this file.
+                f->winner = t;
+                f->hedgeWon = t->hedge;
+                f->length = -1;
+                f->etag.clear();
+                f->modified.clear();
+                f->contentType.clear();
+            }
+        } else if (lower.rfind("accept-ranges:", 0) == 0) {
+            f->acceptRanges = lower.find("bytes") != std::string::npos;
+        } else if (t->kind == Kind::Range) {
+            // Segments share the probe's view of the file.
+        } else if (lower.rfind("etag:", 0) == 0) {
+            f->etag = value;
+        } else if (lower.rfind("last-modified:", 0) == 0) {
+            f->modified = value;
+        } else if (lower.rfind("content-type:", 0) == 0) {
+            f->contentType = value;
+        } else if (lower.rfind("content-length:", 0) == 0) {
+            if (t->status != 206) f->length = std::strtoll(value.c_str(), nullptr, 10);
+        } else if (lower.rfind("content-range:", 0) == 0) {
+            size_t slash = value.find('/');
+            if (slash != std::string::npos && value[slash + 1] != '*')
+                f->length = std::strtoll(value.c_str() + slash + 1, nullptr, 10);
+        }
+        return size * nitems;
+    }
+
+    Transfer* makeTransfer(Fetch* f, Kind kind, curl_off_t offset = 0, curl_off_t end = -1) {
+        Transfer* t = new Transfer();
+        t->fetch = f;
+        t->url = f->task.url;
+        t->host = f->host;
+        t->kind = kind;
+        t->offset = offset;
+        t->end = end;
+        f->pending++;
+        return t;
+    }
+
+    bool openPart(Fetch* f, bool truncate) {
+        if (f->fd >= 0) return true;
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0);
+        f->fd = open(f->task.partname.c_str(), flags, 0644);
+        // Not every filesystem takes O_DIRECT (tmpfs doesn't); fall back quietly.
+        if (f->fd >= 0 && directIo) f->directFd = open(f->task.partname.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        return f->fd >= 0;
+    }
+
+    bool start(Transfer* t) {
+        Fetch* f = t->fetch;
+        if (f->failed) return false;
+        if (f->started == std::chrono::steady_clock::time_point()) f->started = std::chrono::steady_clock::now();
+        if (t->kind != Kind::Probe && !openPart(f, false)) {
+            snprintf(t->errbuf, sizeof(t->errbuf), "Gagal buka file: %s", f->task.partname.c_str());
+            return false;
+        }
+        t->easy = ConnectionPool::instance().acquire(t->host);
+        if (!t->easy) {
+            snprintf(t->errbuf, sizeof(t->errbuf), "Init CURL gagal");
+            return false;
+        }
+        curl_easy_setopt(t->easy, CURLOPT_URL, t->url.c_str());
+        curl_easy_setopt(t->easy, CURLOPT_WRITEFUNCTION, writeData);
+        curl_easy_setopt(t->easy, CURLOPT_WRITEDATA, t);
+        curl_easy_setopt(t->easy, CURLOPT_HEADERFUNCTION, readHeader);
+        curl_easy_setopt(t->easy, CURLOPT_HEADERDATA, t);
+        curl_easy_setopt(t->easy, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(t->easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(t->easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(t->easy, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(t->easy, CURLOPT_ERRORBUFFER, t->errbuf);
+        curl_easy_setopt(t->easy, CURLOPT_PRIVATE, t);
+        if (t->hedge && t->host == f->host) {
+            // A hedge to the same origin must not queue behind the slow connection.
+            curl_easy_setopt(t->easy, CURLOPT_FRESH_CONNECT, 1L);
+            curl_easy_setopt(t->easy, CURLOPT_PIPEWAIT, 0L);
+        }
+        if (t->kind == Kind::Probe) {
+            curl_easy_setopt(t->easy, CURLOPT_NOBODY, 1L);
+        } else if (t->kind == Kind::Range) {
+            std::string range = std::to_string(t->offset) + "-" + std::to_string(t->end);
+            curl_easy_setopt(t->easy, CURLOPT_RANGE, range.c_str());
+        } else if (t->offset > 0) {
+            curl_easy_setopt(t->easy, CURLOPT_RESUME_FROM_LARGE, t->offset);
+            std::string validator = f->etag.empty() ? f->modified : f->etag;
+            t->headers = curl_slist_append(t->headers, ("If-Range: " + validator).c_str());
+        }
+        if (t->kind != Kind::Range && t->offset == 0) {
+            // Revalidate a cached copy so unchanged content costs a 304.
+            if (!f->task.etag.empty())
+                t->headers = curl_slist_append(t->headers, ("If-None-Match: " + f->task.etag).c_str());
+            if (!f->task.modified.empty())
+                t->headers = curl_slist_append(t->headers, ("If-Modified-Since: " + f->task.modified).c_str());
+        }
+        if (t->headers) curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, t->headers);
+        if (t->kind != Kind::Probe) {
+            BandwidthScheduler& bandwidth = BandwidthScheduler::instance();
+            bandwidth.start(TrafficClass::Image);
+            t->metered = true;
+            metered.insert(t);
+            curl_easy_setopt(t->easy, CURLOPT_MAX_RECV_SPEED_LARGE, bandwidth.share(TrafficClass::Image));
+        }
+        curl_multi_add_handle(multi, t->easy);
+        t->launched = std::chrono::steady_clock::now();
+        // Only fresh whole-file GETs race: both halves would write the same part.
+        if (hedgePercentile > 0 && t->kind == Kind::Whole && t->offset == 0 && !t->hedge && !f->raced) {
+            auto delay = std::chrono::duration<double>(hedgeDelay());
+            t->deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
+            armed.insert(t);
+        }
+        return true;
+    }
+
+    double hedgeDelay() {
+        if (firstByte.size() < hedgeWarmup) return hedgeInitial;
+        std::vector<double> samples(firstByte.begin(), firstByte.end());
+        return percentile(samples, hedgePercentile);
+    }
+
+    std::string mirrorFor(const std::string& url) {
+        for (const auto& m : mirrors)
+            if (!m.second.empty() && url.rfind(m.first, 0) == 0)
+                return m.second[mirrorTurn++ % m.second.size()] + url.substr(m.first.size());
+        return url;
+    }
+
+    // Races a duplicate (same URL on a fresh connection, or a mirror) against
+    // every armed transfer still without a response at its deadline. Returns
+    // the milliseconds until the next deadline, capped at the idle poll.
+    int hedge() {
+        int wait = 1000;
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = armed.begin(); it != armed.end();) {
+            Transfer* t = *it;
+            if (t->responded) {
+                it = armed.erase(it);
+                continue;
+            }
+            if (now < t->deadline) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(t->deadline - now).count() + 1;
+                wait = std::min(wait, static_cast<int>(left));
+                ++it;
+                continue;
+            }
+            it = armed.erase(it);
+            Fetch* f = t->fetch;
+            Transfer* h = makeTransfer(f, Kind::Whole);
+            h->hedge = true;
+            h->url = mirrorFor(f->task.url);
+            h->host = urlHost(h->url);
+            f->raced = true;
+            f->racers = {t, h};
+            if (start(h)) {
+                h->lead = std::chrono::duration<double>(h->launched - t->launched).count();
+                inFlight++;
+                hostInFlight[h->host]++;
+                races.insert(f);
+            } else {
+                complete(h, false);
+            }
+            rescan = true;
+        }
+        return wait;
+    }
+
+    // Resumes a whole-file part when the sidecar carries a validator,
+    // otherwise starts over.
+    Transfer* resumeWhole(Fetch* f) {
+        Fetch saved;
+        saved.task.partname = f->task.partname;
+        std::error_code ec;
+        uintmax_t have = fs::file_size(f->task.partname, ec);
+        if (!ec && have > 0 && loadMeta(&saved) && saved.ranges.empty()) {
+            f->etag = saved.etag;
+            f->modified = saved.modified;
+            return makeTransfer(f, Kind::Whole, static_cast<curl_off_t>(have));
+        }
+        dropPart(f);
+        return makeTransfer(f, Kind::Whole);
+    }
+
+    // Splits the file into ranges once the probe has told us its size,
+    // picking up the ranges of an earlier attempt when the file is unchanged.
+    void plan(Fetch* f) {
+        std::deque<Transfer*>& queue = waiting[f->host];
+        rescan = true;
+
+        Fetch saved;
+        saved.task.partname = f->task.partname;
+        bool resumable = loadMeta(&saved) && !saved.ranges.empty() && saved.length == f->length &&
+                         saved.etag == f->etag && saved.modified == f->modified && fs::exists(f->task.partname);
+        if (resumable) {
+            f->ranges = saved.ranges;
+        } else {
+            size_t parts = segments;
+            if (f->acceptRanges && f->length > 0) {
+                curl_off_t maxParts = f->length / minSegmentSize;
+                if (static_cast<curl_off_t>(parts) > maxParts) parts = static_cast<size_t>(maxParts);
+            } else {
+                parts = 1;
+            }
+            if (parts <= 1) {
+                queue.push_front(resumeWhole(f));
+                return;
+            }
+            if (!openPart(f, true) || posix_fallocate(f->fd, 0, f->length) != 0) {
+                f->failed = true;
+                f->error = "Gagal siapkan file: " + f->task.partname;
+                return;
+            }
+            curl_off_t chunk = f->length / static_cast<curl_off_t>(parts);
+            for (size_t i = 0; i < parts; i++) {
+                curl_off_t begin = chunk * static_cast<curl_off_t>(i);
+                curl_off_t end = (i + 1 == parts) ? f->length - 1 : begin + chunk - 1;
+                f->ranges.emplace_back(begin, end);
+            }
+            saveMeta(f);
+        }
+        for (size_t i = f->ranges.size(); i-- > 0;) {
+            if (f->ranges[i].first > f->ranges[i].second) continue;
+            Transfer* t = makeTransfer(f, Kind::Range, f->ranges[i].first, f->ranges[i].second);
+            t->range = i;
+            queue.push_front(t);
+        }
+    }
+
+    // Phase timings come from the first body transfer; bytes add up over all of them.
+    void recordTimes(Transfer* t) {
+        Fetch* f = t->fetch;
+        curl_off_t size = 0;
+        curl_easy_getinfo(t->easy, CURLINFO_SIZE_DOWNLOAD_T, &size);
+        f->bytes += static_cast<uintmax_t>(size);
+        if (f->timed) return;
+        curl_off_t dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+        curl_easy_getinfo(t->easy, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+        curl_easy_getinfo(t->easy, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(t->easy, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(t->easy, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+        curl_easy_getinfo(t->easy, CURLINFO_TOTAL_TIME_T, &total);
+        f->times = {dns / 1e6, connect / 1e6, tls / 1e6, ttfb / 1e6, total / 1e6};
+        f->timed = true;
+        // A hedge's clock starts at the deadline; without its lead the
+        // stall that triggered it is never sampled and the delay drifts down.
+        firstByte.push_back(t->lead + ttfb / 1e6);
+        if (firstByte.size() > hedgeSamples) firstByte.pop_front();
+    }
+
+    // Called once every transfer of a fetch has finished.
+    void finishFetch(Fetch* f) {
+        races.erase(f);
+        if (!f->failed && !f->notModified && f->fd >= 0) {
+            struct stat st;
+            if (fstat(f->fd, &st) != 0 || (f->length >= 0 && st.st_size != f->length)) {
+                f->failed = true;
+                f->discard = true;
+                f->error = "Ukuran file nggak sesuai Content-Length";
+            }
+        }
+        if (f->fd >= 0) close(f->fd);
+        if (f->directFd >= 0) close(f->directFd);
+
+        std::error_code ec;
+        if (f->notModified) {
+            dropPart(f);
+        } else if (!f->failed) {
+            if (f->task.detectType) {
+                // A resumed part never saw its first chunk here; read it back.
+                std::string head = f->head.empty() ? fileHead(f->task.partname, headBytes) : f->head;
+                f->task.filename = fs::path(f->task.filename)
+                                       .replace_extension(imageExtension(head, f->contentType)).string();
+            }
+            fs::rename(f->task.partname, f->task.filename, ec);
+            if (ec) {
+                f->failed = true;
+                f->error = "Gagal rename " + f->task.partname + ": " + ec.message();
+            } else {
+                fs::remove(metaName(f), ec);
+            }
+        } else if (f->discard || fs::file_size(f->task.partname, ec) == 0 || ec) {
+            dropPart(f);
+        } else if (!f->ranges.empty()) {
+            saveMeta(f);
+        }
+
+        auto it = parked.find(f->task.partname);
+        if (it != parked.end()) {
+            Fetch* next = it->second.front();
+            it->second.pop_front();
+            if (it->second.empty()) parked.erase(it);
+            enqueue(next);
+        } else {
+            activeParts.erase(f->task.partname);
+        }
+
+        if (f->task.done) {
+            FetchResult result;
+            result.ok = !f->failed;
+            result.notModified = f->notModified;
+            result.filename = f->task.filename;
+            result.error = f->error;
+            result.etag = f->etag;
+            result.modified = f->modified;
+            result.bytes = f->bytes;
+            result.hasTimes = f->timed;
+            result.times = f->times;
+            result.hedged = f->raced;
+            result.hedgeWon = f->hedgeWon;
+            if (f->started != std::chrono::steady_clock::time_point())
+                result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - f->started).count();
+            f->task.done(result);
+        }
+        delete f;
+        BandwidthScheduler::instance().satisfied(TrafficClass::Image);
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (--outstanding == 0) idleCv.notify_all();
+    }
+
+    void complete(Transfer* t, bool ok) {
+        Fetch* f = t->fetch;
+        armed.erase(t);
+        f->racers.erase(std::remove(f->racers.begin(), f->racers.end(), t), f->racers.end());
+        // A hedged pair reports through the half that answered first; a half
+        // that fails while its twin is still out leaves quietly too.
+        bool dropped = f->raced && t != f->winner && (f->winner || (!ok && !f->racers.empty()));
+        long code = 0;
+        if (t->easy) {
+            curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &code);
+            if (ok && t->kind == Kind::Probe) {
+                curl_off_t length = -1;
+                curl_easy_getinfo(t->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+                f->length = length;
+            } else if (!dropped) {
+                recordTimes(t);
+            }
+            curl_multi_remove_handle(multi, t->easy);
+            ConnectionPool::instance().release(t->host, t->easy);
+        }
+        curl_slist_free_all(t->headers);
+        if (t->metered) {
+            BandwidthScheduler::instance().stop(TrafficClass::Image);
+            metered.erase(t);
+        }
+        if (dropped) {
+            delete t;
+            if (--f->pending == 0) finishFetch(f);
+            return;
+        }
+        t->ok = ok;
+        t->code = code;
+        if (!t->sink) {
+            settle(t);
+            return;
+        }
+        // The disk thread flushes the tail and hands the transfer back
+        // through `flushed`; nothing here waits on write(2).
+        t->sink->finishAsync([this, t](bool written) {
+            t->written = written;
+            // Wakes the loop under mtx: once it lets go, the transfer may
+            // settle and the engine may be torn down.
+            std::lock_guard<std::mutex> lock(mtx);
+            flushed.push_back(t);
+            curl_multi_wakeup(multi);
+        });
+    }
+
+    // Second half of complete(), once the transfer's data is on disk.
+    void settle(Transfer* t) {
+        Fetch* f = t->fetch;
+        bool ok = t->ok;
+        long code = t->code;
+        if (t->sink) {
+            if (!t->written && ok) {
+                ok = false;
+                snprintf(t->errbuf, sizeof(t->errbuf), "Gagal tulis ke %s", f->task.partname.c_str());
+            }
+            if (t->kind == Kind::Range) f->ranges[t->range].first = t->sink->durable;
+        }
+        if (ok && t->kind == Kind::Range && t->offset != t->end + 1) {
+            ok = false;
+            snprintf(t->errbuf, sizeof(t->errbuf), "Segmen sampai byte %lld nggak lengkap",
+                     static_cast<long long>(t->end));
+        }
+        if (!ok && t->kind == Kind::Probe && t->easy) {
+            // Some servers reject HEAD; fall back to a plain GET.
+            ok = true;
+            f->acceptRanges = false;
+            f->length = -1;
+        }
+        if (!ok && !f->failed) {
+            f->failed = true;
+            f->error = t->errbuf;
+        }
+        // 416 means our part no longer lines up with the remote file.
+        if (code == 416) f->discard = true;
+        if (ok && code == 304) f->notModified = true;
+        else if (ok && t->kind == Kind::Probe) plan(f);
+        delete t;
+
+        if (--f->pending == 0) finishFetch(f);
+    }
+
+    // Only one fetch may own a given .part file; duplicates wait their turn.
+    void enqueue(Fetch* f) {
+        activeParts.insert(f->task.partname);
+        waiting[f->host].push_back(segments > 1 ? makeTransfer(f, Kind::Probe) : resumeWhole(f));
+        rescan = true;
+    }
+
+    void admit() {
+        std::deque<Fetch*> fresh;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            fresh.swap(incoming);
+        }
+        for (Fetch* f : fresh) {
+            if (activeParts.count(f->task.partname)) parked[f->task.partname].push_back(f);
+            else enqueue(f);
+        }
+        for (auto it = waiting.begin(); it != waiting.end() && inFlight < maxInFlight;) {
+            auto& queue = it->second;
+            size_t& active = hostInFlight[it->first];
+            while (!queue.empty() && active < maxPerHost && inFlight < maxInFlight) {
+                Transfer* t = queue.front();
+                queue.pop_front();
+                if (start(t)) {
+                    active++;
+                    inFlight++;
+                } else {
+                    failed.push_back(t);
+                }
+            }
+            it = queue.empty() ? waiting.erase(it) : std::next(it);
+        }
+        // Completing may queue more work, so it runs after the walk above.
+        std::deque<Transfer*> done;
+        done.swap(failed);
+        for (Transfer* t : done) complete(t, false);
+    }
+
+    void reap() {
+        int left = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &left)) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            Transfer* t = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &t);
+            CURLcode res = msg->data.result;
+            if (res != CURLE_OK && t->errbuf[0] == '\0')
+                snprintf(t->errbuf, sizeof(t->errbuf), "%s", curl_easy_strerror(res));
+            inFlight--;
+            hostInFlight[t->host]--;
+            rescan = true;
+            complete(t, res == CURLE_OK);
+        }
+    }
+
+    void settleFlushed() {
+        std::deque<Transfer*> done;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done.swap(flushed);
+        }
+        for (Transfer* t : done) settle(t);
+    }
+
+    // Once one half of a hedged pair has answered, the other is stopped.
+    void settleRaces() {
+        for (auto it = races.begin(); it != races.end();) {
+            Fetch* f = *it;
+            if (!f->winner) {
+                ++it;
+                continue;
+            }
+            it = races.erase(it);
+            std::vector<Transfer*> losers;
+            for (Transfer* t : f->racers)
+                if (t != f->winner) losers.push_back(t);
+            for (Transfer* t : losers) {
+                inFlight--;
+                hostInFlight[t->host]--;
+                rescan = true;
+                complete(t, false);
+            }
+        }
+    }
+
+    // Hands every running transfer its new slice of the bandwidth cap.
+    void retune() {
+        BandwidthScheduler& bandwidth = BandwidthScheduler::instance();
+        uint64_t generation = bandwidth.generation();
+        if (generation == tuned) return;
+        tuned = generation;
+        if (!bandwidth.limited()) return;
+        curl_off_t share = bandwidth.share(TrafficClass::Image);
+        for (Transfer* t : metered) curl_easy_setopt(t->easy, CURLOPT_MAX_RECV_SPEED_LARGE, share);
+    }
+
+    void loop() {
+        while (true) {
+            admit();
+            retune();
+            int running = 0;
+            curl_multi_perform(multi, &running);
+            reap();
+            settleRaces();
+            settleFlushed();
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (stopping && outstanding == 0) break;
+            }
+            int timeout = hedge();
+            if (rescan) {
+                rescan = false;
+                continue;
+            }
+            curl_multi_poll(multi, nullptr, 0, timeout, nullptr);
+        }
+    }
+
+public:
+    // hedgePercentile > 0 turns on hedging; mirrors maps a URL prefix to
+    // the prefixes a hedge may be sent to instead.
+    ImageEngine(size_t maxInFlight, size_t maxPerHost, size_t segments = 1, bool directIo = false,
+                double hedgePercentile = 0,
+                std::vector<std::pair<std::string, std::vector<std::string>>> mirrors = {})
+        : maxInFlight(maxInFlight ? maxInFlight : 1), maxPerHost(maxPerHost ? maxPerHost : 1),
+          segments(segments ? segments : 1), directIo(directIo), hedgePercentile(hedgePercentile),
+          mirrors(std::move(mirrors)) {
+        multi = curl_multi_init();
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(this->maxPerHost));
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(this->maxInFlight));
+        loopThread = std::thread([this] { loop(); });
+    }
+
+    ~ImageEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        curl_multi_wakeup(multi);
+        loopThread.join();
+        curl_multi_cleanup(multi);
+    }
+
+    void add(ImageTask task) {
+        Fetch* f = new Fetch();
+        f->host = urlHost(task.url);
+        f->task = std::move(task);
+        if (f->task.partname.empty()) f->task.partname = f->task.filename + ".part";
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            incoming.push_back(f);
+            outstanding++;
+        }
+        BandwidthScheduler::instance().want(TrafficClass::Image);
+        curl_multi_wakeup(multi);
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        idleCv.wait(lock, [this] { return outstanding == 0; });
+    }
+};
+
+struct Fragment {
+    std::string url;
+    std::string range;  // "first-last" for byte-range fragments, empty for the whole resource
+};
+
+// One elementary stream: an optional init fragment followed by the media
+// fragments, concatenated in order.
+struct StreamTrack {
+    std::string kind;
+    std::vector<Fragment> fragments;
+};
+
+// Minimal HLS (m3u8) and DASH (MPD) reader: picks the highest-bandwidth
+// variant and lists the fragment URLs of each track. Encrypted HLS and
+// DASH without a segment template/list fall outside it; callers should
+// leave those to yt-dlp.
+class StreamManifest {
+private:
+    static std::string hlsAttr(const std::string& line, const std::string& key) {
+        std::smatch m;
+        std::regex re("[:,]" + key + "=(\"([^\"]*)\"|[^,]*)");
+        if (!std::regex_search(line, m, re)) return "";
+        return m[2].matched ? m[2].str() : m[1].str();
+    }
+
+    static std::string xmlAttr(const std::string& element, const std::string& key) {
+        std::smatch m;
+        std::string open = element.substr(0, element.find('>'));
+        std::regex re("\\s" + key + "=\"([^\"]*)\"");
+        if (!std::regex_search(open, m, re)) return "";
+        std::string value = m[1].str();
+        for (size_t pos; (pos = value.find("&amp;")) != std::string::npos;) value.replace(pos, 5, "&");
+        return value;
+    }
+
+    // Every <tag ...>...</tag> or <tag .../> in xml, in order. Assumes the
+    // tag doesn't nest inside itself, which holds for the MPD elements used.
+    static std::vector<std::string> xmlBlocks(const std::string& xml, const std::string& tag) {
+        std::vector<std::string> blocks;
+        size_t pos = 0;
+        while ((pos = xml.find("<" + tag, pos)) != std::string::npos) {
+            char after = pos + tag.size() + 1 < xml.size() ? xml[pos + tag.size() + 1] : '>';
+            if (after != ' ' && after != '>' && after != '/' && after != '\n' && after != '\t' && after != '\r') {
+                pos += tag.size() + 1;
+                continue;
+            }
+            size_t openEnd = xml.find('>', pos);
+            if (openEnd == std::string::npos) break;
+            size_t end = openEnd + 1;
+            if (xml[openEnd - 1] != '/') {
+                size_t close = xml.find("</" + tag + ">", openEnd);
+                end = close == std::string::npos ? xml.size() : close + tag.size() + 3;
+            }
+            blocks.push_back(xml.substr(pos, end - pos));
+            pos = end;
+        }
+        return blocks;
+    }
+
+    static std::string xmlText(const std::string& xml, const std::string& tag) {
+        std::vector<std::string> blocks = xmlBlocks(xml, tag);
+        if (blocks.empty()) return "";
+        const std::string& b = blocks.front();
+        size_t start = b.find('>') + 1;
+        size_t end = b.rfind("</");
+        if (end == std::string::npos || end < start) return "";
+        std::string text = b.substr(start, end - start);
+        text.erase(0, text.find_first_not_of(" \t\r\n"));
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        return text;
+    }
+
+    // Manifest numbers come off the network: a malformed one fails the job
+    // instead of throwing out of the worker thread that parses it.
+    static bool toInt(const std::string& text, long long& out) {
+        char* end = nullptr;
+        errno = 0;
+        long long value = std::strtoll(text.c_str(), &end, 10);
+        if (text.empty() || errno != 0 || *end != '\0') return false;
+        out = value;
+        return true;
+    }
+
+    static bool toReal(const std::string& text, double& out) {
+        char* end = nullptr;
+        errno = 0;
+        double value = std::strtod(text.c_str(), &end);
+        if (text.empty() || errno != 0 || *end != '\0' || !std::isfinite(value)) return false;
+        out = value;
+        return true;
+    }
+
+    // ISO 8601 duration as used by MPDs, e.g. PT1H2M3.5S.
+    static double isoSeconds(const std::string& value) {
+        std::smatch m;
+        std::regex re("P(?:(\\d+)D)?T?(?:(\\d+)H)?(?:(\\d+)M)?(?:([\\d.]+)S)?");
+        if (!std::regex_match(value, m, re)) return 0;
+        const double unit[] = {0, 86400, 3600, 60, 1};
+        double s = 0;
+        for (int i = 1; i <= 4; i++) {
+            double part = 0;
+            if (m[i].matched && !toReal(m[i].str(), part)) return 0;
+            s += part * unit[i];
+        }
+        return s;
+    }
+
+    // Expands $RepresentationID$, $Bandwidth$, $Number%05d$, $Time$ and $$.
+    static std::string fillTemplate(const std::string& tmpl, const std::string& id, const std::string& bandwidth,
+                                    long long number, long long time) {
+        std::string out;
+        for (size_t i = 0; i < tmpl.size(); i++) {
+            size_t end = tmpl[i] == '$' ? tmpl.find('$', i + 1) : std::string::npos;
+            if (end == std::string::npos) {
+                out += tmpl[i];
+                continue;
+            }
+            std::string name = tmpl.substr(i + 1, end - i - 1);
+            std::string format = "%d";
+            size_t pct = name.find('%');
+            if (pct != std::string::npos) {
+                format = name.substr(pct);
+                name = name.substr(0, pct);
+            }
+            char buf[64];
+            if (name.empty()) {
+                out += '$';
+            } else if (name == "RepresentationID") {
+                out += id;
+            } else if (name == "Bandwidth") {
+                out += bandwidth;
+            } else if (name == "Number" || name == "Time") {
+                std::string fmt = format.substr(0, format.size() - 1) + "lld";
+                snprintf(buf, sizeof(buf), fmt.c_str(), name == "Number" ? number : time);
+                out += buf;
+            } else {
+                out += tmpl.substr(i, end - i + 1);
+            }
+            i = end;
+        }
+        return out;
+    }
+
+public:
+    static std::string resolve(const std::string& base, const std::string& ref) {
+        CURLU* u = curl_url();
+        std::string out = ref;
+        char* full = nullptr;
+        if (curl_url_set(u, CURLUPART_URL, base.c_str(), 0) == CURLUE_OK &&
+            curl_url_set(u, CURLUPART_URL, ref.c_str(), 0) == CURLUE_OK &&
+            curl_url_get(u, CURLUPART_URL, &full, 0) == CURLUE_OK) {
+            out = full;
+        }
+        curl_free(full);
+        curl_url_cleanup(u);
+        return out;
+    }
+
+    static bool isHls(const std::string& text) { return text.rfind("#EXTM3U", 0) == 0; }
+
+    // A master playlist yields its best variant (and separate audio
+    // rendition, if any) through `variants`; a media playlist yields a track.
+    static bool parseHls(const std::string& text, const std::string& base, std::vector<std::string>& variants,
+                         StreamTrack& track, std::string& error) {
+        std::istringstream in(text);
+        std::string line;
+        std::string pendingRange;
+        std::string lastResource;
+        long long nextOffset = 0;
+        bool isSegment = false;
+        long long bestBandwidth = -1;
+        std::string bestUri;
+        std::string bestAudio;
+        std::map<std::string, std::string> audioGroups;
+        bool expectVariant = false;
+        long long variantBandwidth = 0;
+        std::string variantAudio;
+
+        std::string lastMap;
+
+        auto byteRange = [&](const std::string& spec, const std::string& resource, std::string& range) {
+            size_t at = spec.find('@');
+            long long length = 0;
+            long long offset = resource == lastResource ? nextOffset : 0;
+            if (!toInt(spec.substr(0, at), length) || length <= 0 ||
+                (at != std::string::npos && (!toInt(spec.substr(at + 1), offset) || offset < 0))) {
+                error = "BYTERANGE HLS nggak valid: " + spec;
+                return false;
+            }
+            lastResource = resource;
+            nextOffset = offset + length;
+            range = std::to_string(offset) + "-" + std::to_string(offset + length - 1);
+            return true;
+        };
+
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            if (line.rfind("#EXT-X-STREAM-INF", 0) == 0) {
+                expectVariant = true;
+                std::string bw = hlsAttr(line, "BANDWIDTH");
+                if (!toInt(bw, variantBandwidth)) variantBandwidth = 0;
+                variantAudio = hlsAttr(line, "AUDIO");
+            } else if (line.rfind("#EXT-X-MEDIA:", 0) == 0) {
+                std::string uri = hlsAttr(line, "URI");
+                std::string group = hlsAttr(line, "GROUP-ID");
+                if (hlsAttr(line, "TYPE") == "AUDIO" && !uri.empty() &&
+                    (!audioGroups.count(group) || hlsAttr(line, "DEFAULT") == "YES"))
+                    audioGroups[group] = resolve(base, uri);
+            } else if (line.rfind("#EXT-X-KEY", 0) == 0) {
+                std::string method = hlsAttr(line, "METHOD");
+                if (!method.empty() && method != "NONE") {
+                    error = "HLS terenkripsi (" + method + ") nggak didukung";
+                    return false;
+                }
+            } else if (line.rfind("#EXT-X-MAP", 0) == 0) {
+                Fragment init;
+                init.url = resolve(base, hlsAttr(line, "URI"));
+                std::string range = hlsAttr(line, "BYTERANGE");
+                if (!range.empty() && !byteRange(range, init.url, init.range)) return false;
+                // A map applies to the segments after it, so it goes out in
+                // playlist order; repeating the current one changes nothing.
+                if (init.url + " " + init.range != lastMap) track.fragments.push_back(init);
+                lastMap = init.url + " " + init.range;
+            } else if (line.rfind("#EXT-X-BYTERANGE:", 0) == 0) {
+                pendingRange = line.substr(17);
+            } else if (line.rfind("#EXTINF", 0) == 0) {
+                isSegment = true;
+            } else if (line[0] != '#') {
+                std::string uri = resolve(base, line);
+                if (expectVariant) {
+                    if (variantBandwidth > bestBandwidth) {
+                        bestBandwidth = variantBandwidth;
+                        bestUri = uri;
+                        bestAudio = variantAudio;
+                    }
+                    expectVariant = false;
+                } else if (isSegment) {
+                    Fragment f;
+                    f.url = uri;
+                    if (!pendingRange.empty() && !byteRange(pendingRange, uri, f.range)) return false;
+                    track.fragments.push_back(f);
+                    pendingRange.clear();
+                    isSegment = false;
+                }
+            }
+        }
+        if (!bestUri.empty()) {
+            variants.push_back(bestUri);
+            auto audio = audioGroups.find(bestAudio);
+            if (audio != audioGroups.end()) variants.push_back(audio->second);
+            return true;
+        }
+        if (track.fragments.empty()) {
+            error = "Playlist HLS kosong";
+            return false;
+        }
+        return true;
+    }
+
+    // Best representation of the video and of the audio adaptation sets.
+    // Only single-Period MPDs: each Period would need its own init segment
+    // and output, and the tracks are written to one part file per kind.
+    static bool parseDash(const std::string& xml, const std::string& base, std::vector<StreamTrack>& tracks,
+                          std::string& error) {
+        std::vector<std::string> periods = xmlBlocks(xml, "Period");
+        if (periods.size() > 1) {
+            error = "MPD dengan " + std::to_string(periods.size()) + " Period nggak didukung";
+            return false;
+        }
+        std::string head = xml.substr(0, xml.find("<Period"));
+        std::string mpdBase = resolve(base, xmlText(head, "BaseURL"));
+        size_t root = xml.find("<MPD");
+        double duration = periods.empty() ? 0 : isoSeconds(xmlAttr(periods.front(), "duration"));
+        if (duration <= 0 && root != std::string::npos)
+            duration = isoSeconds(xmlAttr(xml.substr(root), "mediaPresentationDuration"));
+        std::vector<long long> trackBandwidth;
+        for (const std::string& set : xmlBlocks(xml, "AdaptationSet")) {
+            std::string setType = xmlAttr(set, "contentType");
+            if (setType.empty()) setType = xmlAttr(set, "mimeType");
+            std::string best;
+            long long bestBandwidth = -1;
+            for (const std::string& rep : xmlBlocks(set, "Representation")) {
+                long long bandwidth = 0;
+                if (!toInt(xmlAttr(rep, "bandwidth"), bandwidth)) bandwidth = 0;
+                if (bandwidth > bestBandwidth) {
+                    bestBandwidth = bandwidth;
+                    best = rep;
+                }
+            }
+            if (best.empty()) continue;
+            std::string type = setType.empty() ? xmlAttr(best, "mimeType") : setType;
+            StreamTrack track;
+            track.kind = type.find("audio") != std::string::npos ? "audio"
+                         : type.find("video") != std::string::npos ? "video" : "";
+            if (track.kind.empty()) continue;
+
+            std::string setHead = set.substr(0, set.find("<Representation"));
+            std::string repBase = resolve(mpdBase, xmlText(setHead, "BaseURL"));
+            repBase = resolve(repBase, xmlText(best, "BaseURL"));
+            std::string id = xmlAttr(best, "id");
+            std::string bandwidth = xmlAttr(best, "bandwidth");
+
+            std::vector<std::string> templates = xmlBlocks(best, "SegmentTemplate");
+            if (templates.empty()) templates = xmlBlocks(setHead, "SegmentTemplate");
+            std::vector<std::string> lists = xmlBlocks(best, "SegmentList");
+
+            if (!templates.empty()) {
+                const std::string& t = templates.front();
+                std::string media = xmlAttr(t, "media");
+                std::string init = xmlAttr(t, "initialization");
+                std::string startAttr = xmlAttr(t, "startNumber");
+                std::string scaleAttr = xmlAttr(t, "timescale");
+                std::string durAttr = xmlAttr(t, "duration");
+                std::string offsetAttr = xmlAttr(t, "presentationTimeOffset");
+                long long number = 1;
+                double timescale = 1;
+                long long timeOffset = 0;
+                if ((!startAttr.empty() && !toInt(startAttr, number)) ||
+                    (!scaleAttr.empty() && (!toReal(scaleAttr, timescale) || timescale <= 0)) ||
+                    (!offsetAttr.empty() && !toInt(offsetAttr, timeOffset))) {
+                    error = "SegmentTemplate dengan atribut nggak valid";
+                    return false;
+                }
+                if (!init.empty()) track.fragments.push_back({resolve(repBase, fillTemplate(init, id, bandwidth, 0, 0)), ""});
+                std::vector<std::string> timeline = xmlBlocks(t, "S");
+                if (!timeline.empty()) {
+                    long long time = 0;
+                    for (size_t i = 0; i < timeline.size(); i++) {
+                        const std::string& s = timeline[i];
+                        std::string tAttr = xmlAttr(s, "t");
+                        std::string rAttr = xmlAttr(s, "r");
+                        long long d = 0;
+                        long long repeat = 0;
+                        if ((!tAttr.empty() && !toInt(tAttr, time)) || !toInt(xmlAttr(s, "d"), d) || d <= 0 ||
+                            (!rAttr.empty() && !toInt(rAttr, repeat))) {
+                            error = "SegmentTimeline dengan atribut nggak valid";
+                            return false;
+                        }
+                        if (repeat < 0) {
+                            // Repeats up to the next entry's start, or to the
+                            // end of the Period for the last one.
+                            long long until = 0;
+                            if (i + 1 < timeline.size()) {
+                                if (!toInt(xmlAttr(timeline[i + 1], "t"), until)) until = 0;
+                            } else if (duration > 0) {
+                                until = timeOffset + std::llround(duration * timescale);
+                            }
+                            if (until <= time) {
+                                error = "SegmentTimeline r=-1 tanpa batas akhir nggak didukung";
+                                return false;
+                            }
+                            repeat = (until - time + d - 1) / d - 1;
+                        }
+                        for (long long r = 0; r <= repeat; r++) {
+                            track.fragments.push_back({resolve(repBase, fillTemplate(media, id, bandwidth, number++, time)), ""});
+                            time += d;
+                        }
+                    }
+                } else if (!durAttr.empty() && duration > 0) {
+                    double segment = 0;
+                    if (!toReal(durAttr, segment) || segment <= 0) {
+                        error = "SegmentTemplate dengan durasi nggak valid";
+                        return false;
+                    }
+                    segment /= timescale;
+                    long long count = static_cast<long long>(std::ceil(duration / segment - 1e-9));
+                    for (long long i = 0; i < count; i++, number++)
+                        track.fragments.push_back({resolve(repBase, fillTemplate(media, id, bandwidth, number, 0)), ""});
+                } else {
+                    error = "SegmentTemplate tanpa durasi atau timeline";
+                    return false;
+                }
+            } else if (!lists.empty()) {
+                const std::string& list = lists.front();
+                std::vector<std::string> inits = xmlBlocks(list, "Initialization");
+                if (!inits.empty()) {
+                    std::string range = xmlAttr(inits.front(), "range");
+                    std::string source = xmlAttr(inits.front(), "sourceURL");
+                    track.fragments.push_back({source.empty() ? repBase : resolve(repBase, source), range});
+                }
+                for (const std::string& seg : xmlBlocks(list, "SegmentURL")) {
+                    std::string source = xmlAttr(seg, "media");
+                    track.fragments.push_back({source.empty() ? repBase : resolve(repBase, source), xmlAttr(seg, "mediaRange")});
+                }
+            } else {
+                // SegmentBase or a plain BaseURL: one file per track.
+                track.fragments.push_back({repBase, ""});
+            }
+            // Alternative sets of one kind (e.g. per codec) would share a
+            // part file; keep the richest one.
+            size_t same = 0;
+            while (same < tracks.size() && tracks[same].kind != track.kind) same++;
+            if (same == tracks.size()) {
+                tracks.push_back(track);
+                trackBandwidth.push_back(bestBandwidth);
+            } else if (bestBandwidth > trackBandwidth[same]) {
+                tracks[same] = track;
+                trackBandwidth[same] = bestBandwidth;
+            }
+        }
+        if (tracks.empty()) {
+            error = "MPD tanpa track video/audio yang bisa dipakai";
+            return false;
+        }
+        return true;
+    }
+};
+
+// Fetches the fragments of one track over the shared connection pool with
+// up to `parallel` transfers, handing bodies to `write` strictly in order.
+// At most `window` fragments are in flight or waiting for an earlier one,
+// which bounds the reordering memory.
+class FragmentFetcher {
+public:
+    using WriteFn = std::function<bool(const std::string& body)>;
+    using ChunkFn = std::function<bool(const char* data, size_t len)>;
+
+private:
+    static constexpr int maxAttempts = 3;
+
+    struct Slot {
+        size_t index = 0;
+        int attempts = 0;
+        std::string body;
+        CURL* easy = nullptr;
+        std::string host;
+        bool ranged = false;
+        long status = 0;
+        char errbuf[CURL_ERROR_SIZE] = {0};
+    };
+
+    size_t parallel;
+    size_t window;
+    curl_off_t maxSpeed;
+
+    static size_t collect(void* ptr, size_t size, size_t nmemb, Slot* slot) {
+        // A byte-range fragment answered with anything but 206 is the whole
+        // resource; appending it would corrupt the track.
+        if (slot->ranged && slot->easy) {
+            curl_easy_getinfo(slot->easy, CURLINFO_RESPONSE_CODE, &slot->status);
+            if (slot->status != 206) return 0;
+        }
+        slot->body.append(static_cast<const char*>(ptr), size * nmemb);
+        return size * nmemb;
+    }
+
+    bool start(CURLM* multi, Slot* slot, const Fragment& f) {
+        slot->body.clear();
+        slot->errbuf[0] = '\0';
+        slot->ranged = !f.range.empty();
+        slot->status = 0;
+        slot->host = urlHost(f.url);
+        slot->easy = ConnectionPool::instance().acquire(slot->host);
+        if (!slot->easy) return false;
+        curl_easy_setopt(slot->easy, CURLOPT_URL, f.url.c_str());
+        curl_easy_setopt(slot->easy, CURLOPT_WRITEFUNCTION, collect);
+        curl_easy_setopt(slot->easy, CURLOPT_WRITEDATA, slot);
+        curl_easy_setopt(slot->easy, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(slot->easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(slot->easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(slot->easy, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(slot->easy, CURLOPT_ERRORBUFFER, slot->errbuf);
+        curl_easy_setopt(slot->easy, CURLOPT_PRIVATE, slot);
+        if (!f.range.empty()) curl_easy_setopt(slot->easy, CURLOPT_RANGE, f.range.c_str());
+        if (maxSpeed > 0) curl_easy_setopt(slot->easy, CURLOPT_MAX_RECV_SPEED_LARGE, maxSpeed);
+        curl_multi_add_handle(multi, slot->easy);
+        return true;
+    }
+
+    struct Pass {
+        CURL* easy = nullptr;
+        std::string* finalUrl = nullptr;
+        const ChunkFn* onChunk = nullptr;
+        bool started = false;
+    };
+
+    static size_t pass(void* ptr, size_t size, size_t nmemb, Pass* p) {
+        if (!p->started) {
+            char* effective = nullptr;
+            curl_easy_getinfo(p->easy, CURLINFO_EFFECTIVE_URL, &effective);
+            if (effective) *p->finalUrl = effective;
+            p->started = true;
+        }
+        return (*p->onChunk)(static_cast<const char*>(ptr), size * nmemb) ? size * nmemb : 0;
+    }
+
+public:
+    // Blocking GET that hands the body over chunk by chunk as it arrives;
+    // finalUrl is where redirects ended up and is set before the first
+    // chunk. onChunk returning false aborts the transfer.
+    static bool fetch(const std::string& url, const ChunkFn& onChunk, std::string& finalUrl, std::string& error) {
+        std::string host = urlHost(url);
+        char errbuf[CURL_ERROR_SIZE] = {0};
+        CURL* easy = ConnectionPool::instance().acquire(host);
+        if (!easy) {
+            error = "Init CURL gagal";
+            return false;
+        }
+        finalUrl = url;
+        Pass p;
+        p.easy = easy;
+        p.finalUrl = &finalUrl;
+        p.onChunk = &onChunk;
+        curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, pass);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, &p);
+        curl_easy_setopt(easy, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, errbuf);
+        CURLcode res = curl_easy_perform(easy);
+        char* effective = nullptr;
+        curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &effective);
+        if (effective) finalUrl = effective;
+        ConnectionPool::instance().release(host, easy);
+        if (res != CURLE_OK) {
+            error = errbuf[0] ? errbuf : curl_easy_strerror(res);
+            return false;
+        }
+        return true;
+    }
+
+    // Blocking GET of a small resource (a manifest); finalUrl is where
+    // redirects ended up, which relative URIs resolve against.
+    static bool fetch(const std::string& url, std::string& body, std::string& finalUrl, std::string& error) {
+        std::string collected;
+        ChunkFn append = [&collected](const char* data, size_t len) {
+            collected.append(data, len);
+            return true;
+        };
+        if (!fetch(url, append, finalUrl, error)) return false;
+        body = std::move(collected);
+        return true;
+    }
+
+    FragmentFetcher(size_t parallel, curl_off_t maxSpeed = 0)
+        : parallel(parallel ? parallel : 1), window(2 * (parallel ? parallel : 1)), maxSpeed(maxSpeed) {}
+
+    bool run(const std::vector<Fragment>& fragments, WriteFn write, std::string& error) {
+        CURLM* multi = curl_multi_init();
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        std::map<size_t, std::string> ready;
+        std::vector<std::unique_ptr<Slot>> active;
+        size_t nextStart = 0;
+        size_t nextWrite = 0;
+        bool ok = true;
+
+        while (ok && nextWrite < fragments.size()) {
+            bool progressed = false;
+            while (active.size() < parallel && nextStart < fragments.size() && nextStart - nextWrite < window) {
+                auto slot = std::make_unique<Slot>();
+                slot->index = nextStart++;
+                if (!start(multi, slot.get(), fragments[slot->index])) {
+                    error = "Init CURL gagal";
+                    ok = false;
+                    break;
+                }
+                active.push_back(std::move(slot));
+            }
+            if (!ok) break;
+
+            int running = 0;
+            curl_multi_perform(multi, &running);
+            int left = 0;
+            while (CURLMsg* msg = curl_multi_info_read(multi, &left)) {
+                if (msg->msg != CURLMSG_DONE) continue;
+                progressed = true;
+                Slot* slot = nullptr;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &slot);
+                CURLcode res = msg->data.result;
+                curl_multi_remove_handle(multi, slot->easy);
+                ConnectionPool::instance().release(slot->host, slot->easy);
+                slot->easy = nullptr;
+                bool rangeIgnored = slot->ranged && slot->status != 0 && slot->status != 206;
+                if (res == CURLE_OK && !rangeIgnored) {
+                    ready[slot->index] = std::move(slot->body);
+                } else if (!rangeIgnored && ++slot->attempts < maxAttempts &&
+                           start(multi, slot, fragments[slot->index])) {
+                    continue;
+                } else if (rangeIgnored) {
+                    error = "Fragmen " + std::to_string(slot->index) + " gagal: server abaikan Range (HTTP " +
+                            std::to_string(slot->status) + ")";
+                    ok = false;
+                } else {
+                    error = "Fragmen " + std::to_string(slot->index) + " gagal: " +
+                            (slot->errbuf[0] ? slot->errbuf : curl_easy_strerror(res));
+                    ok = false;
+                }
+                for (auto it = active.begin(); it != active.end(); ++it) {
+                    if (it->get() == slot) {
+                        active.erase(it);
+                        break;
+                    }
+                }
+            }
+            for (auto it = ready.find(nextWrite); ok && it != ready.end(); it = ready.find(nextWrite)) {
+                if (!write(it->second)) {
+                    error = "Gagal tulis fragmen " + std::to_string(nextWrite);
+                    ok = false;
+                }
+                ready.erase(it);
+                nextWrite++;
+            }
+            // A finished fragment may have opened the window; refill before sleeping.
+            if (ok && !progressed && nextWrite < fragments.size()) curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+        }
+        for (auto& slot : active) {
+            if (!slot->easy) continue;
+            curl_multi_remove_handle(multi, slot->easy);
+            ConnectionPool::instance().release(slot->host, slot->easy);
+        }
+        curl_multi_cleanup(multi);
+        return ok;
+    }
+};
+
+// Incremental HTML scanner for page scraping: fed the page as it arrives,
+// it reports the image URLs of every <img> (src, data-src, srcset) and
+// <picture> <source> (srcset) as soon as the tag is complete, resolved
+// against the page or its <base href>. Only an unfinished tag or comment
+// is carried between chunks, never the whole page.
+class PageScanner {
+public:
+    using UrlFn = std::function<void(const std::string& url)>;
+
+private:
+    static constexpr size_t maxCarry = 1 << 16;
+
+    std::string base;
+    bool baseTag = false;
+    UrlFn onUrl;
+    std::string carry;
+    std::string rawEnd;  // "</script" or "</style" while inside one
+    std::unordered_set<std::string> seen;
+
+    static std::string lower(std::string s) {
+        for (char& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return s;
+    }
+
+    static std::string decode(std::string value) {
+        static const std::pair<const char*, const char*> entities[] = {
+            {"&quot;", "\""}, {"&#39;", "'"}, {"&apos;", "'"}, {"&lt;", "<"}, {"&gt;", ">"}, {"&amp;", "&"}};
+        for (const auto& e : entities) {
+            size_t len = strlen(e.first);
+            for (size_t pos = 0; (pos = value.find(e.first, pos)) != std::string::npos; pos++)
+                value.replace(pos, len, e.second);
+        }
+        return value;
+    }
+
+    // End of the tag opening at `from` ('>' outside quoted attribute values).
+    static size_t tagEnd(const std::string& text, size_t from) {
+        char quote = 0;
+        char last = 0;
+        for (size_t i = from + 1; i < text.size(); i++) {
+            char c = text[i];
+            if (quote) {
+                if (c == quote) quote = 0;
+            } else if ((c == '"' || c == '\'') && last == '=') {
+                quote = c;
+            } else if (c == '>') {
+                return i;
+            }
+            if (!std::isspace(static_cast<unsigned char>(c))) last = c;
+        }
+        return std::string::npos;
+    }
+
+    static std::map<std::string, std::string> attributes(const std::string& tag, std::string& name) {
+        std::map<std::string, std::string> attrs;
+        auto space = [&tag](size_t i) { return std::isspace(static_cast<unsigned char>(tag[i])) != 0; };
+        size_t i = 1;
+        while (i < tag.size() && !space(i) && tag[i] != '>' && tag[i] != '/') name += tag[i++];
+        name = lower(name);
+        while (i < tag.size()) {
+            while (i < tag.size() && (space(i) || tag[i] == '/')) i++;
+            if (i >= tag.size() || tag[i] == '>') break;
+            std::string key;
+            while (i < tag.size() && !space(i) && tag[i] != '=' && tag[i] != '>' && tag[i] != '/') key += tag[i++];
+            while (i < tag.size() && space(i)) i++;
+            std::string value;
+            if (i < tag.size() && tag[i] == '=') {
+                i++;
+                while (i < tag.size() && space(i)) i++;
+                if (i < tag.size() && (tag[i] == '"' || tag[i] == '\'')) {
+                    size_t close = tag.find(tag[i], i + 1);
+                    if (close == std::string::npos) close = tag.size();
+                    value = tag.substr(i + 1, close - i - 1);
+                    i = close + 1;
+                } else {
+                    while (i < tag.size() && !space(i) && tag[i] != '>') value += tag[i++];
+                }
+            }
+            if (!key.empty()) attrs.emplace(lower(key), decode(value));
+        }
+        return attrs;
+    }
+
+    void emit(std::string ref) {
+        ref.erase(0, ref.find_first_not_of(" \t\r\n"));
+        ref.erase(ref.find_last_not_of(" \t\r\n") + 1);
+        std::string scheme = lower(ref.substr(0, 11));
+        if (ref.empty() || ref[0] == '#' || scheme.rfind("data:", 0) == 0 || scheme.rfind("javascript:", 0) == 0)
+            return;
+        std::string url = StreamManifest::resolve(base, ref);
+        if (seen.insert(url).second) onUrl(url);
+    }
+
+    // HTML's srcset rules: a URL runs to the next whitespace (so it may hold
+    // commas, as in data: URLs) minus trailing commas, and its descriptors
+    // run to the next comma outside parentheses.
+    void emitSrcset(const std::string& srcset) {
+        auto space = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f'; };
+        size_t i = 0;
+        while (i < srcset.size()) {
+            while (i < srcset.size() && (space(srcset[i]) || srcset[i] == ',')) i++;
+            size_t start = i;
+            while (i < srcset.size() && !space(srcset[i])) i++;
+            std::string ref = srcset.substr(start, i - start);
+            bool ended = false;
+            while (!ref.empty() && ref.back() == ',') {
+                ref.pop_back();
+                ended = true;
+            }
+            if (!ref.empty()) emit(ref);
+            if (ended) continue;
+            for (int depth = 0; i < srcset.size() && (depth > 0 || srcset[i] != ','); i++) {
+                if (srcset[i] == '(') depth++;
+                else if (srcset[i] == ')' && depth > 0) depth--;
+            }
+        }
+    }
+
+    void tag(const std::string& text) {
+        std::string name;
+        auto attrs = attributes(text, name);
+        if (name == "script" || name == "style") {
+            if (text[text.size() - 2] != '/') rawEnd = "</" + name;
+        } else if (name == "base") {
+            auto href = attrs.find("href");
+            if (!baseTag && href != attrs.end()) {
+                base = StreamManifest::resolve(base, href->second);
+                baseTag = true;
+            }
+        } else if (name == "img" || name == "source") {
+            // A <source> src belongs to <video>/<audio>; only srcset means an image.
+            for (const char* key : {"src", "data-src"}) {
+                auto it = attrs.find(key);
+                if (name == "img" && it != attrs.end()) emit(it->second);
+            }
+            for (const char* key : {"srcset", "data-srcset"}) {
+                auto it = attrs.find(key);
+                if (it != attrs.end()) emitSrcset(it->second);
+            }
+        }
+    }
+
+public:
+    PageScanner(const std::string& pageUrl, UrlFn onUrl) : base(pageUrl), onUrl(std::move(onUrl)) {}
+
+    // Where the page really came from (after redirects); ignored once a
+    // <base href> has been seen.
+    void rebase(const std::string& pageUrl) {
+        if (!baseTag) base = pageUrl;
+    }
+
+    void feed(const char* data, size_t len) {
+        carry.append(data, len);
+        size_t pos = 0;
+        while (pos < carry.size()) {
+            if (!rawEnd.empty()) {
+                size_t end = lower(carry).find(rawEnd, pos);
+                if (end == std::string::npos) {
+                    // Keep just enough to spot an end tag split across chunks.
+                    pos = std::max(pos, carry.size() - std::min(carry.size(), rawEnd.size()));
+                    break;
+                }
+                rawEnd.clear();
+                pos = end;
+            }
+            size_t lt = carry.find('<', pos);
+            if (lt == std::string::npos || lt + 4 > carry.size()) {
+                pos = lt == std::string::npos ? carry.size() : lt;
+                break;
+            }
+            pos = lt;
+            if (carry.compare(lt, 4, "<!--") == 0) {
+                size_t end = carry.find("-->", lt + 4);
+                if (end == std::string::npos) break;
+                pos = end + 3;
+                continue;
+            }
+            char next = carry[lt + 1];
+            if (!std::isalpha(static_cast<unsigned char>(next)) && next != '/' && next != '!') {
+                pos = lt + 1;
+                continue;
+            }
+            size_t end = tagEnd(carry, lt);
+            if (end == std::string::npos) break;
+            tag(carry.substr(lt, end - lt + 1));
+            pos = end + 1;
+        }
+        carry.erase(0, pos);
+        // A tag or comment this long is broken markup; drop it rather than grow.
+        if (carry.size() > maxCarry) carry.clear();
+    }
+};
+
+// Spawns children with posix_spawn (no shell, argv passed as-is) and
+// supervises all of them from one epoll thread: stdout/stderr are read
+// without blocking and handed out line by line, exit codes via callback.
+class ProcessRunner {
+public:
+    using LineFn = std::function<void(const std::string& line, bool isErr)>;
+    using ExitFn = std::function<void(int code)>;
+
+private:
+    struct Child;
+
+    struct Stream {
+        Child* child = nullptr;
+        int fd = -1;
+        bool isErr = false;
+        std::string pending;
+    };
+
+    struct Child {
+        pid_t pid = -1;
+        Stream out;
+        Stream err;
+        int open = 2;
+        LineFn onLine;
+        ExitFn onExit;
+    };
+
+    int epfd = -1;
+    int wakefd = -1;
+    std::thread loopThread;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> running{0};
+    std::vector<Child*> exiting;
+
+    static void emit(Stream& s, bool flush) {
+        size_t start = 0;
+        for (size_t i = 0; i < s.pending.size(); i++) {
+            // yt-dlp redraws progress with '\r', treat it as a line break too.
+            if (s.pending[i] != '\n' && s.pending[i] != '\r') continue;
+            if (i > start && s.child->onLine) s.child->onLine(s.pending.substr(start, i - start), s.isErr);
+            start = i + 1;
+        }
+        s.pending.erase(0, start);
+        if (flush && !s.pending.empty()) {
+            if (s.child->onLine) s.child->onLine(s.pending, s.isErr);
+            s.pending.clear();
+        }
+    }
+
+    void drain(Stream& s) {
+        char buf[16384];
+        while (true) {
+            ssize_t n = read(s.fd, buf, sizeof(buf));
+            if (n > 0) {
+                s.pending.append(buf, static_cast<size_t>(n));
+                emit(s, false);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EAGAIN) return;
+            emit(s, true);
+            epoll_ctl(epfd, EPOLL_CTL_DEL, s.fd, nullptr);
+            close(s.fd);
+            s.fd = -1;
+            if (--s.child->open == 0) exiting.push_back(s.child);
+            return;
+        }
+    }
+
+    // Both pipes are closed; collect whoever has actually exited.
+    void reap() {
+        for (auto it = exiting.begin(); it != exiting.end();) {
+            Child* c = *it;
+            int status = 0;
+            pid_t r = waitpid(c->pid, &status, WNOHANG);
+            if (r == 0) {
+                ++it;
+                continue;
+            }
+            int code = -1;
+            if (r == c->pid) code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            it = exiting.erase(it);
+            if (c->onExit) c->onExit(code);
+            delete c;
+            running--;
+        }
+    }
+
+    void loop() {
+        epoll_event events[64];
+        while (true) {
+            int timeout = exiting.empty() ? -1 : 50;
+            int n = epoll_wait(epfd, events, 64, timeout);
+            for (int i = 0; i < n; i++) {
+                if (events[i].data.ptr == nullptr) {
+                    uint64_t value;
+                    if (read(wakefd, &value, sizeof(value)) < 0) {}
+                    continue;
+                }
+                drain(*static_cast<Stream*>(events[i].data.ptr));
+            }
+            reap();
+            if (stopping && running == 0) return;
+        }
+    }
+
+    bool watch(Stream& s) {
+        fcntl(s.fd, F_SETFL, fcntl(s.fd, F_GETFL) | O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &s;
+        return epoll_ctl(epfd, EPOLL_CTL_ADD, s.fd, &ev) == 0;
+    }
+
+    ProcessRunner() {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+        loopThread = std::thread([this] { loop(); });
+    }
+
+    ~ProcessRunner() {
+        stopping = true;
+        uint64_t one = 1;
+        if (write(wakefd, &one, sizeof(one)) < 0) {}
+        loopThread.join();
+        close(wakefd);
+        close(epfd);
+    }
+
+public:
+    static ProcessRunner& instance() {
+        static ProcessRunner runner;
+        return runner;
+    }
+
+    // Returns false if the child could not be started; onExit is not called then.
+    bool spawn(const std::vector<std::string>& args, LineFn onLine, ExitFn onExit) {
+        int outPipe[2], errPipe[2];
+        if (pipe2(outPipe, O_CLOEXEC) != 0) return false;
+        if (pipe2(errPipe, O_CLOEXEC) != 0) {
+            close(outPipe[0]);
+            close(outPipe[1]);
+            return false;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, outPipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, errPipe[1], STDERR_FILENO);
+
+        std::vector<char*> argv;
+        for (const auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+
+        Child* c = new Child();
+        int rc = posix_spawnp(&c->pid, argv[0], &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(outPipe[1]);
+        close(errPipe[1]);
+        if (rc != 0) {
+            close(outPipe[0]);
+            close(errPipe[0]);
+            delete c;
+            return false;
+        }
+
+        c->onLine = std::move(onLine);
+        c->onExit = std::move(onExit);
+        c->out = {c, outPipe[0], false, ""};
+        c->err = {c, errPipe[0], true, ""};
+        running++;
+        watch(c->out);
+        watch(c->err);
+        return true;
+    }
+
+    // Blocking convenience wrapper; -1 if the child could not be started.
+    int run(const std::vector<std::string>& args, LineFn onLine) {
+        std::promise<int> exited;
+        auto code = exited.get_future();
+        if (!spawn(args, std::move(onLine), [&exited](int rc) { exited.set_value(rc); })) return -1;
+        return code.get();
+    }
+};
+
+// Runs at most `limit` asynchronous tasks at once, and at most `perKey` of
+// those with the same key (e.g. host). Lower priority values start first;
+// each task gets a release callback it must call exactly once when it finishes.
+class TaskGate {
+private:
+    using Task = std::function<void(std::function<void()> release)>;
+
+    struct Entry {
+        Task task;
+        std::string key;
+    };
+
+    std::mutex mtx;
+    std::condition_variable idleCv;
+    std::map<int, std::deque<Entry>> queued;
+    std::unordered_map<std::string, size_t> keyActive;
+    size_t limit;
+    size_t perKey;
+    size_t active = 0;
+    // Threads inside pump(), counted before they let go of mtx, so wait()
+    // can't return (and the gate be destroyed) while one is still on its way.
+    size_t busy = 0;
+    bool pumping = false;
+
+    bool idle() const { return active == 0 && queued.empty() && busy == 0; }
+
+    // First queued entry, by priority, whose key still has room.
+    bool takeNext(Entry& next) {
+        for (auto it = queued.begin(); it != queued.end(); ++it) {
+            auto& entries = it->second;
+            for (auto e = entries.begin(); e != entries.end(); ++e) {
+                if (!e->key.empty() && keyActive[e->key] >= perKey) continue;
+                next = std::move(*e);
+                entries.erase(e);
+                if (entries.empty()) queued.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Only one thread pumps at a time, so tasks that finish synchronously
+    // loop here instead of recursing through release(). The caller has
+    // already counted itself in `busy`; the gate isn't touched after the
+    // last lock below is released.
+    void pump() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (pumping) {
+                leave();
+                return;
+            }
+            pumping = true;
+        }
+        while (true) {
+            Entry next;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (active >= limit || !takeNext(next)) {
+                    pumping = false;
+                    leave();
+                    return;
+                }
+                active++;
+                if (!next.key.empty()) keyActive[next.key]++;
+            }
+            next.task([this, key = next.key] {
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    active--;
+                    if (!key.empty() && --keyActive[key] == 0) keyActive.erase(key);
+                    // Once idle, wait() may return and destroy the gate; don't touch it again.
+                    if (queued.empty()) {
+                        if (idle()) idleCv.notify_all();
+                        return;
+                    }
+                    busy++;
+                }
+                pump();
+            });
+        }
+    }
+
+    // Called with mtx held by a thread on its way out of pump().
+    void leave() {
+        busy--;
+        if (idle()) idleCv.notify_all();
+    }
+
+public:
+    explicit TaskGate(size_t limit, size_t perKey = 0)
+        : limit(limit ? limit : 1), perKey(perKey ? perKey : this->limit) {}
+
+    void submit(Task task, int priority = 0, const std::string& key = "") {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            queued[priority].push_back({std::move(task), key});
+            busy++;
+        }
+        pump();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        idleCv.wait(lock, [this] { return idle(); });
+    }
+};
+
+struct JobMetrics {
+    std::string mode;
+    std::string host;
+    std::string result;
+    uintmax_t bytes = 0;
+    double seconds = 0;
+    bool hasTimes = false;
+    TransferTimes times;
+    bool hedged = false;
+    bool hedgeWon = false;
+};
+
+// Collects per-job metrics and aggregates them into histograms keyed by
+// mode and host, exported as a JSON summary and a Prometheus textfile.
+class MetricsRegistry {
+private:
+    struct Histogram {
+        std::vector<uint64_t> counts;
+        double sum = 0;
+        uint64_t count = 0;
+    };
+
+    struct Series {
+        std::map<std::string, uint64_t> results;
+        uint64_t bytes = 0;
+        uint64_t hedged = 0;
+        uint64_t hedgeWon = 0;
+        std::map<std::string, Histogram> phases;
+    };
+
+    const std::vector<double> buckets = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1,
+                                         2.5, 5, 10, 30, 60, 120, 300, 600};
+    std::mutex mtx;
+    std::map<std::pair<std::string, std::string>, Series> series;
+    std::vector<JobMetrics> jobs;
+
+    void observe(Series& s, const std::string& phase, double value) {
+        Histogram& h = s.phases[phase];
+        if (h.counts.empty()) h.counts.assign(buckets.size(), 0);
+        for (size_t i = 0; i < buckets.size(); i++)
+            if (value <= buckets[i]) h.counts[i]++;
+        h.sum += value;
+        h.count++;
+    }
+
+    static std::string label(const std::string& value) {
+        std::string out;
+        for (char c : value) {
+            if (c == '\\' || c == '"') out += '\\';
+            out += c == '\n' ? ' ' : c;
+        }
+        return out;
+    }
+
+    static bool writeAtomic(const std::string& path, const std::string& body) {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << body;
+            if (!out) return false;
+        }
+        std::error_code ec;
+        fs::rename(tmp, path, ec);
+        return !ec;
+    }
+
+public:
+    // Exact tail latencies over this run's successful jobs of one mode.
+    struct Tail {
+        size_t count = 0;
+        double p50 = 0, p90 = 0, p99 = 0, max = 0;
+        size_t timed = 0;
+        double ttfb50 = 0, ttfb99 = 0;
+        size_t hedged = 0;
+        size_t hedgeWon = 0;
+    };
+
+    Tail tail(const std::string& mode) {
+        std::lock_guard<std::mutex> lock(mtx);
+        Tail t;
+        std::vector<double> totals, ttfbs;
+        for (const auto& j : jobs) {
+            if (j.mode != mode || (j.result != "ok" && j.result != "not_modified")) continue;
+            totals.push_back(j.seconds);
+            if (j.hasTimes) ttfbs.push_back(j.times.ttfb);
+            t.hedged += j.hedged;
+            t.hedgeWon += j.hedgeWon;
+        }
+        t.count = totals.size();
+        if (!totals.empty()) {
+            t.p50 = percentile(totals, 50);
+            t.p90 = percentile(totals, 90);
+            t.p99 = percentile(totals, 99);
+            t.max = *std::max_element(totals.begin(), totals.end());
+        }
+        t.timed = ttfbs.size();
+        if (!ttfbs.empty()) {
+            t.ttfb50 = percentile(ttfbs, 50);
+            t.ttfb99 = percentile(ttfbs, 99);
+        }
+        return t;
+    }
+
+    void record(const JobMetrics& job) {
+        std::lock_guard<std::mutex> lock(mtx);
+        jobs.push_back(job);
+        Series& s = series[{job.mode, job.host}];
+        s.results[job.result]++;
+        s.bytes += job.bytes;
+        s.hedged += job.hedged;
+        s.hedgeWon += job.hedgeWon;
+        // Cache hits and failures would skew the latency histograms.
+        if (job.result != "ok" && job.result != "not_modified") return;
+        observe(s, "total", job.seconds);
+        if (!job.hasTimes) {
+            observe(s, "process", job.seconds);
+            return;
+        }
+        observe(s, "dns", job.times.dns);
+        observe(s, "connect", job.times.connectPhase());
+        if (job.times.tls > 0) observe(s, "tls", job.times.tlsPhase());
+        observe(s, "wait", job.times.waitPhase());
+        observe(s, "transfer", job.times.transferPhase());
+    }
+
+    bool writeJson(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(6) << "{\"jobs\":[";
+        for (size_t i = 0; i < jobs.size(); i++) {
+            const JobMetrics& j = jobs[i];
+            std::string mode, host;
+            jsonEscape(mode, j.mode);
+            jsonEscape(host, j.host);
+            out << (i ? "," : "") << "{\"mode\":\"" << mode << "\",\"host\":\"" << host << "\",\"result\":\""
+                << j.result << "\",\"bytes\":" << j.bytes << ",\"seconds\":" << j.seconds
+                << ",\"throughput\":" << (j.seconds > 0 ? j.bytes / j.seconds : 0);
+            if (j.hasTimes)
+                out << ",\"dns\":" << j.times.dns << ",\"connect\":" << j.times.connectPhase()
+                    << ",\"tls\":" << j.times.tlsPhase() << ",\"wait\":" << j.times.waitPhase()
+                    << ",\"transfer\":" << j.times.transferPhase() << ",\"ttfb\":" << j.times.ttfb;
+            if (j.hedged) out << ",\"hedged\":true,\"hedge_won\":" << (j.hedgeWon ? "true" : "false");
+            out << "}";
+        }
+        out << "],\"series\":[";
+        bool first = true;
+        for (const auto& entry : series) {
+            std::string mode, host;
+            jsonEscape(mode, entry.first.first);
+            jsonEscape(host, entry.first.second);
+            out << (first ? "" : ",") << "{\"mode\":\"" << mode << "\",\"host\":\"" << host
+                << "\",\"bytes\":" << entry.second.bytes << ",\"hedged\":" << entry.second.hedged
+                << ",\"hedge_won\":" << entry.second.hedgeWon << ",\"results\":{";
+            first = false;
+            bool firstResult = true;
+            for (const auto& r : entry.second.results) {
+                out << (firstResult ? "" : ",") << "\"" << r.first << "\":" << r.second;
+                firstResult = false;
+            }
+            out << "},\"phases\":{";
+            bool firstPhase = true;
+            for (const auto& p : entry.second.phases) {
+                out << (firstPhase ? "" : ",") << "\"" << p.first << "\":{\"count\":" << p.second.count
+                    << ",\"avg\":" << (p.second.count ? p.second.sum / p.second.count : 0) << "}";
+                firstPhase = false;
+            }
+            out << "}}";
+        }
+        out << "]}\n";
+        return writeAtomic(path, out.str());
+    }
+
+    // Node exporter textfile format; written to a temp file and renamed so
+    // the collector never sees a half-written scrape.
+    bool writePrometheus(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::ostringstream out;
+        out << "# HELP cyberfetch_downloads_total Finished download jobs.\n"
+            << "# TYPE cyberfetch_downloads_total counter\n";
+        for (const auto& entry : series)
+            for (const auto& r : entry.second.results)
+                out << "cyberfetch_downloads_total{mode=\"" << label(entry.first.first) << "\",host=\""
+                    << label(entry.first.second) << "\",result=\"" << r.first << "\"} " << r.second << "\n";
+
+        out << "# HELP cyberfetch_download_bytes_total Bytes written by download jobs.\n"
+            << "# TYPE cyberfetch_download_bytes_total counter\n";
+        for (const auto& entry : series)
+            out << "cyberfetch_download_bytes_total{mode=\"" << label(entry.first.first) << "\",host=\""
+                << label(entry.first.second) << "\"} " << entry.second.bytes << "\n";
+
+        out << "# HELP cyberfetch_hedged_total Downloads that raced a hedged duplicate request.\n"
+            << "# TYPE cyberfetch_hedged_total counter\n";
+        for (const auto& entry : series) {
+            if (!entry.second.hedged) continue;
+            std::string labels = "mode=\"" + label(entry.first.first) + "\",host=\"" + label(entry.first.second) + "\"";
+            out << "cyberfetch_hedged_total{" << labels << ",won=\"true\"} " << entry.second.hedgeWon << "\n"
+                << "cyberfetch_hedged_total{" << labels << ",won=\"false\"} "
+                << entry.second.hedged - entry.second.hedgeWon << "\n";
+        }
+
+        out << "# HELP cyberfetch_download_phase_seconds Time spent in each download phase, not cumulative.\n"
+            << "# TYPE cyberfetch_download_phase_seconds histogram\n";
+        for (const auto& entry : series) {
+            for (const auto& p : entry.second.phases) {
+                std::string labels = "mode=\"" + label(entry.first.first) + "\",host=\"" +
+                                     label(entry.first.second) + "\",phase=\"" + p.first + "\"";
+                for (size_t i = 0; i < buckets.size(); i++)
+                    out << "cyberfetch_download_phase_seconds_bucket{" << labels << ",le=\"" << buckets[i]
+                        << "\"} " << p.second.counts[i] << "\n";
+                out << "cyberfetch_download_phase_seconds_bucket{" << labels << ",le=\"+Inf\"} " << p.second.count << "\n"
+                    << "cyberfetch_download_phase_seconds_sum{" << labels << "} " << p.second.sum << "\n"
+                    << "cyberfetch_download_phase_seconds_count{" << labels << "} " << p.second.count << "\n";
+            }
+        }
+        return writeAtomic(path, out.str());
+    }
+};
+
+// Minimal SHA-256, only used to name objects in the download cache.
+class Sha256 {
+private:
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char block[64];
+    size_t used = 0;
+    uint64_t total = 0;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const unsigned char* p) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t(p[i * 4]) << 24) | (uint32_t(p[i * 4 + 1]) << 16) |
+                   (uint32_t(p[i * 4 + 2]) << 8) | uint32_t(p[i * 4 + 3]);
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+public:
+    void update(const void* data, size_t len) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        total += len;
+        while (len > 0) {
+            size_t n = std::min(len, sizeof(block) - used);
+            memcpy(block + used, p, n);
+            used += n;
+            p += n;
+            len -= n;
+            if (used == sizeof(block)) {
+                compress(block);
+                used = 0;
+            }
+        }
+    }
+
+    std::string hex() {
+        uint64_t bits = total * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        unsigned char zero = 0;
+        while (used != 56) update(&zero, 1);
+        unsigned char len[8];
+        for (int i = 0; i < 8; i++) len[i] = static_cast<unsigned char>(bits >> (56 - i * 8));
+        update(len, 8);
+        std::ostringstream out;
+        for (uint32_t v : state) out << std::hex << std::setw(8) << std::setfill('0') << v;
+        return out.str();
+    }
+
+    static std::string ofFile(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return "";
+        Sha256 sha;
+        std::vector<char> buf(1 << 20);
+        while (in) {
+            in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+            sha.update(buf.data(), static_cast<size_t>(in.gcount()));
+        }
+        return sha.hex();
+    }
+};
+
+// Content-addressed store: objects/<aa>/<sha256> plus an append-only
+// index mapping a URL key to its object and HTTP validators. Outputs are
+// hard links (or reflinks/copies across filesystems) into the store.
+class DownloadCache {
+public:
+    struct Entry {
+        std::string hash;
+        std::string etag;
+        std::string modified;
+    };
+
+private:
+    fs::path root;
+    std::mutex mtx;
+    std::unordered_map<std::string, Entry> index;
+
+    fs::path objectPath(const std::string& hash) const {
+        return root / "objects" / hash.substr(0, 2) / hash;
+    }
+
+    static std::string field(const std::string& value) { return value.empty() ? "-" : value; }
+
+    static bool cloneFile(const fs::path& from, const fs::path& to) {
+        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) return false;
+        int out = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        bool ok = out >= 0 && ioctl(out, FICLONE, in) == 0;
+        if (out >= 0) close(out);
+        close(in);
+        if (!ok && out >= 0) unlink(to.c_str());
+        return ok;
+    }
+
+public:
+    explicit DownloadCache(const std::string& dir) : root(dir) {
+        std::error_code ec;
+        fs::create_directories(root / "objects", ec);
+        std::ifstream in(root / "index.tsv");
+        std::string line;
+        while (std::getline(in, line)) {
+            std::vector<std::string> cols;
+            std::istringstream ss(line);
+            std::string col;
+            while (std::getline(ss, col, '\t')) cols.push_back(col == "-" ? "" : col);
+            if (cols.size() == 4) index[cols[0]] = {cols[1], cols[2], cols[3]};
+        }
+    }
+
+    bool lookup(const std::string& key, Entry& entry) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = index.find(key);
+        if (it == index.end() || !fs::exists(objectPath(it->second.hash))) return false;
+        entry = it->second;
+        return true;
+    }
+
+    // Places the cached object at dest: hard link, then reflink, then copy.
+    bool link(const std::string& hash, const std::string& dest) {
+        fs::path object = objectPath(hash);
+        std::error_code ec;
+        fs::remove(dest, ec);
+        fs::create_hard_link(object, dest, ec);
+        if (!ec) return true;
+        if (cloneFile(object, dest)) return true;
+        return fs::copy_file(object, dest, ec);
+    }
+
+    // Moves a finished download into the store and links it back in place.
+    void store(const std::string& key, const std::string& file, const std::string& etag = "",
+               const std::string& modified = "") {
+        std::string hash = Sha256::ofFile(file);
+        if (hash.empty()) return;
+        fs::path object = objectPath(hash);
+        std::error_code ec;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            fs::create_directories(object.parent_path(), ec);
+            if (!fs::exists(object)) {
+                fs::create_hard_link(file, object, ec);
+                if (ec) fs::copy_file(file, object, ec);
+                if (ec) return;
+            }
+            auto it = index.find(key);
+            bool same = it != index.end() && it->second.hash == hash && it->second.etag == etag &&
+                        it->second.modified == modified;
+            index[key] = {hash, etag, modified};
+            if (!same) {
+                std::ofstream out(root / "index.tsv", std::ios::app);
+                out << key << '\t' << hash << '\t' << field(etag) << '\t' << field(modified) << '\n';
+            }
+        }
+        if (!fs::equivalent(object, file, ec)) link(hash, file);
+    }
+};
+
+// Append-only daemon journal, one tab-separated line per event:
+//   add <id> <mode> <url> <quality> <path> <name>
+//   done <id> ok|failed <bytes>
+// Each line is fdatasync'd before the daemon acts on it. Replaying gives
+// the jobs that never finished; since the output name is journaled too, a
+// rerun picks up the same .part files.
+class JobJournal {
+public:
+    struct Record {
+        uint64_t id = 0;
+        Job job;
+    };
+
+private:
+    std::string path;
+    std::mutex mtx;
+    int fd = -1;
+
+    static std::string field(const std::string& value) { return value.empty() ? "-" : value; }
+
+    void append(const std::string& line) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (fd < 0) return;
+        if (write(fd, line.data(), line.size()) == static_cast<ssize_t>(line.size())) fdatasync(fd);
+    }
+
+public:
+    explicit JobJournal(const std::string& path) : path(path) {}
+
+    ~JobJournal() {
+        if (fd >= 0) close(fd);
+    }
+
+    // Reads the journal, rewrites it with only the unfinished jobs and
+    // opens it for appending. nextId is set past every id seen.
+    std::vector<Record> recover(uint64_t& nextId) {
+        std::map<uint64_t, Record> pending;
+        nextId = 1;
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::vector<std::string> cols;
+            std::istringstream ss(line);
+            std::string col;
+            while (std::getline(ss, col, '\t')) cols.push_back(col == "-" ? "" : col);
+            if (cols.size() < 3) continue;
+            uint64_t id = std::strtoull(cols[1].c_str(), nullptr, 10);
+            nextId = std::max(nextId, id + 1);
+            if (cols[0] == "add" && cols.size() == 7) {
+                Record& r = pending[id];
+                r.id = id;
+                r.job = {cols[2], cols[3], cols[4], cols[5], cols[6]};
+            } else if (cols[0] == "done") {
+                pending.erase(id);
+            }
+        }
+        in.close();
+
+        std::vector<Record> records;
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            for (auto& entry : pending) {
+                const Job& job = entry.second.job;
+                out << "add\t" << entry.first << '\t' << job.mode << '\t' << job.url << '\t' << field(job.quality)
+                    << '\t' << field(job.path) << '\t' << field(job.name) << '\n';
+                records.push_back(entry.second);
+            }
+        }
+        std::error_code ec;
+        fs::rename(tmp, path, ec);
+        std::lock_guard<std::mutex> lock(mtx);
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        return records;
+    }
+
+    bool isOpen() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return fd >= 0;
+    }
+
+    void added(uint64_t id, const Job& job) {
+        append("add\t" + std::to_string(id) + '\t' + job.mode + '\t' + job.url + '\t' + field(job.quality) + '\t' +
+               field(job.path) + '\t' + field(job.name) + '\n');
+    }
+
+    void finished(uint64_t id, bool ok, uintmax_t bytes) {
+        append("done\t" + std::to_string(id) + '\t' + (ok ? "ok" : "failed") + '\t' + std::to_string(bytes) + '\n');
+    }
+};
+
+// Per-job yt-dlp progress. Updates only touch the table; a render thread
+// aggregates it at a fixed rate, so 50 jobs give one status line instead
+// of one log line per progress tick.
+class ProgressBoard {
+public:
+    struct State {
+        double done = 0;
+        double total = 0;
+        double speed = 0;
+        double eta = -1;
+    };
+
+    static constexpr const char* marker = "CFPROG";
+
+    // Matches the --progress-template handed to yt-dlp.
+    static std::string progressTemplate() {
+        return std::string("download:") + marker +
+               " %(progress.downloaded_bytes)s %(progress.total_bytes)s"
+               " %(progress.total_bytes_estimate)s %(progress.speed)s %(progress.eta)s";
+    }
+
+    static bool parse(const std::string& line, State& state) {
+        size_t at = line.find(marker);
+        if (at == std::string::npos) return false;
+        std::istringstream in(line.substr(at + strlen(marker)));
+        std::string done, total, estimate, speed, eta;
+        if (!(in >> done >> total >> estimate >> speed >> eta)) return false;
+        auto num = [](const std::string& v, double def) {
+            char* end = nullptr;
+            double d = std::strtod(v.c_str(), &end);
+            return end == v.c_str() ? def : d;
+        };
+        state.done = num(done, 0);
+        state.total = num(total, num(estimate, 0));
+        state.speed = num(speed, 0);
+        state.eta = num(eta, -1);
+        return true;
+    }
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::unordered_map<size_t, State> jobs;
+    size_t nextId = 0;
+    size_t finished = 0;
+    bool stopping = false;
+    std::chrono::milliseconds interval;
+    std::function<void(const std::string&)> draw;
+    std::thread renderThread;
+
+    std::string render() {
+        State sum;
+        size_t active = jobs.size();
+        for (const auto& entry : jobs) {
+            sum.done += entry.second.done;
+            sum.total += entry.second.total;
+            sum.speed += entry.second.speed;
+            sum.eta = std::max(sum.eta, entry.second.eta);
+        }
+        if (active == 0) return "";
+        std::ostringstream out;
+        out << active << " job aktif, " << finished << " selesai | " << formatBytes(sum.done, 1);
+        if (sum.total > 0) out << " / " << formatBytes(sum.total, 1);
+        out << " | " << formatBytes(sum.speed, 1) << "/s";
+        if (sum.eta >= 0) out << " | ETA " << static_cast<long>(sum.eta) / 60 << "m" << static_cast<long>(sum.eta) % 60 << "s";
+        return out.str();
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!stopping) {
+            cv.wait_for(lock, interval, [this] { return stopping; });
+            std::string line = render();
+            lock.unlock();
+            draw(line);
+            lock.lock();
+        }
+    }
+
+public:
+    ProgressBoard(std::function<void(const std::string&)> draw, std::chrono::milliseconds interval)
+        : interval(interval), draw(std::move(draw)) {
+        renderThread = std::thread([this] { loop(); });
+    }
+
+    ~ProgressBoard() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        renderThread.join();
+        draw("");
+    }
+
+    size_t begin() {
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t id = nextId++;
+        jobs[id] = State();
+        return id;
+    }
+
+    void update(size_t id, const State& state) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it != jobs.end()) it->second = state;
+    }
+
+    void end(size_t id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (jobs.erase(id)) finished++;
+    }
+};
+
 class Downloader {
 private:
-    std::mutex logMutex;
+    AsyncLogger logger;
+    std::mutex boardMutex;
+    size_t curlJobs = 64;
+    size_t hostJobs = 8;
+    size_t segments = 1;
+    bool directIo = false;
+    double hedgePercentile = 0;
+    std::vector<std::pair<std::string, std::vector<std::string>>> mirrors;
+    bool clientOk = true;
+    std::unique_ptr<DownloadCache> cache;
+    MetricsRegistry metrics;
+    std::string metricsJson;
+    std::string metricsProm;
+    std::unique_ptr<WorkerPool> cachePool;
+    std::mutex streamMutex;
+    std::unique_ptr<WorkerPool> streamPool;
+    size_t cpuJobs = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<size_t> cpuWaiting{0};
+    std::mutex stageMutex;
+    std::unique_ptr<TaskGate> cpuGate;
+    std::unique_ptr<ImageEngine> imageEngine;
+    std::unique_ptr<ProgressBoard> board;
+
+    ProgressBoard& progress() {
+        std::lock_guard<std::mutex> lock(boardMutex);
+        if (!board) {
+            // Redraw in place on a terminal; piped output gets a line every few seconds.
+            auto interval = std::chrono::milliseconds(logger.isInteractive() ? 250 : 5000);
+            board = std::make_unique<ProgressBoard>([this](const std::string& line) { logger.setStatus(line); }, interval);
+        }
+        return *board;
+    }
+
+    // Created up front in run() with the cache: the engine and supervisor
+    // threads both reach for it.
+    WorkerPool& cacheWorkers() { return *cachePool; }
 
-    static size_t writeData(void* ptr, size_t size, size_t nmemb, FILE* stream) {
-        return fwrite(ptr, size, nmemb, stream);
+    bool fromCache(const std::string& mode, const std::string& url, const std::string& key,
+                   const std::string& filename) {
+        DownloadCache::Entry entry;
+        if (!cache || !cache->lookup(key, entry) || !cache->link(entry.hash, filename)) return false;
+        log("Ada di cache, skip download: " + filename, LogLevel::Ok);
+        JobMetrics job;
+        job.mode = mode;
+        job.host = urlHost(url);
+        job.result = "cached";
+        metrics.record(job);
+        return true;
+    }
+
+    WorkerPool& streamWorkers() {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        if (!streamPool) streamPool = std::make_unique<WorkerPool>(4);
+        return *streamPool;
+    }
+
+    ImageEngine& images() {
+        if (!imageEngine)
+            imageEngine = std::make_unique<ImageEngine>(curlJobs, hostJobs, segments, directIo, hedgePercentile, mirrors);
+        return *imageEngine;
     }
 
     std::string generateUUID() {
@@ -28,74 +3526,626 @@ private:
         return std::string(uuidStr);
     }
 
+    static std::string urlKey(const std::string& url) {
+        uint64_t hash = 1469598103934665603ULL;
+        for (unsigned char c : url) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        std::ostringstream out;
+        out << std::hex << std::setw(16) << std::setfill('0') << hash;
+        return out.str();
+    }
+
     std::string ensureDir(const std::string& dirPath) {
         fs::path path(dirPath);
-        if (!fs::exists(path)) {
-            fs::create_directories(path);
-            log("Buat folder: " + path.string(), "INFO");
-        }
+        std::error_code ec;
+        if (fs::create_directories(path, ec))
+            log("Buat folder: " + path.string(), LogLevel::Info);
         return path.string() + "/";
     }
 
-    void log(const std::string& msg, const std::string& prefix = "INFO") {
-    std::lock_guard<std::mutex> lock(logMutex);
-
-    if (prefix == "OK")
-        std::cout << "\033[1;32m[✔] " << msg << "\033[0m\n";
-    else if (prefix == "ERR")
-        std::cerr << "\033[1;31m[✘] " << msg << "\033[0m\n"; 
-    else if (prefix == "YT")
-        std::cout << "\033[1;35m[YT] " << msg << "\033[0m\n";
-    else if (prefix == "PROGRESS")
-        std::cout << "\033[1;34m[⇣] " << msg << "\033[0m\n";
-    else if (prefix == "WARN")
-        std::cout << "\033[1;33m[!] " << msg << "\033[0m\n"; 
-    else if (prefix == "SYSTEM")
-        std::cout << "\033[1;36m[*] " << msg << "\033[0m\n"; 
-    else
-        std::cout << "\033[1;34m[*] " << msg << "\033[0m\n"; 
-}
+    void log(const std::string& msg, LogLevel level = LogLevel::Info) {
+        logger.push(level, msg);
+    }
+
+    DownloadResult finish(DownloadResult& result, bool ok, const std::string& filename) {
+        result.ok = ok;
+        result.file = filename;
+        std::error_code ec;
+        uintmax_t size = fs::file_size(filename, ec);
+        if (ok && !ec) result.bytes = size;
+        return result;
+    }
+
+    static std::string takeFlag(std::vector<std::string>& args, const std::string& flag, const std::string& def = "") {
+        for (size_t i = 0; i + 1 < args.size(); i++) {
+            if (args[i] == flag) {
+                std::string value = args[i + 1];
+                args.erase(args.begin() + i, args.begin() + i + 2);
+                return value;
+            }
+        }
+        return def;
+    }
+
+    static bool takeSwitch(std::vector<std::string>& args, const std::string& flag) {
+        auto it = std::find(args.begin(), args.end(), flag);
+        if (it == args.end()) return false;
+        args.erase(it);
+        return true;
+    }
+
+    static size_t toCount(const std::string& value, size_t def) {
+        try {
+            long n = std::stol(value);
+            return n > 0 ? static_cast<size_t>(n) : def;
+        } catch (...) {
+            return def;
+        }
+    }
+
+    // "500K", "2.5M", "1G" or plain bytes per second; 0 when absent or invalid.
+    static curl_off_t toRate(const std::string& value) {
+        try {
+            size_t used = 0;
+            double n = std::stod(value, &used);
+            std::string unit = value.substr(used);
+            if (unit == "K" || unit == "k") n *= 1024;
+            else if (unit == "M" || unit == "m") n *= 1024 * 1024;
+            else if (unit == "G" || unit == "g") n *= 1024.0 * 1024 * 1024;
+            else if (!unit.empty()) return 0;
+            return n > 0 ? static_cast<curl_off_t>(n) : 0;
+        } catch (...) {
+            return 0;
+        }
+    }
+
+    bool parseJob(const std::vector<std::string>& tokens, Job& job) {
+        if (tokens.size() < 2) return false;
+        job.mode = tokens[0];
+        job.url = tokens[1];
+        if (job.mode == "--video") {
+            if (tokens.size() < 4) return false;
+            job.quality = tokens[2];
+            job.path = tokens[3];
+        } else if (job.mode == "--audio" || job.mode == "--image" || job.mode == "--stream" || job.mode == "--page") {
+            job.path = tokens.size() > 2 ? tokens[2] : "";
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    static std::string ffmpeg() {
+        const char* bin = std::getenv("CYBERFETCH_FFMPEG");
+        return bin && *bin ? bin : "ffmpeg";
+    }
+
+    // Reads an HLS or DASH manifest into the tracks to download.
+    static bool streamTracks(const std::string& url, std::vector<StreamTrack>& tracks, std::string& error) {
+        std::string body, base;
+        if (!FragmentFetcher::fetch(url, body, base, error)) return false;
+        if (body.find("<MPD") != std::string::npos) return StreamManifest::parseDash(body, base, tracks, error);
+        if (!StreamManifest::isHls(body)) {
+            error = "Bukan manifest HLS/DASH";
+            return false;
+        }
+        std::vector<std::string> variants;
+        StreamTrack track;
+        if (!StreamManifest::parseHls(body, base, variants, track, error)) return false;
+        if (variants.empty()) {
+            track.kind = "video";
+            tracks.push_back(track);
+            return true;
+        }
+        // Master playlist: best variant, plus its separate audio rendition if any.
+        for (size_t i = 0; i < variants.size(); i++) {
+            std::vector<std::string> nested;
+            StreamTrack media;
+            if (!FragmentFetcher::fetch(variants[i], body, base, error) ||
+                !StreamManifest::parseHls(body, base, nested, media, error))
+                return false;
+            if (!nested.empty()) {
+                error = "Master playlist bertingkat nggak didukung";
+                return false;
+            }
+            media.kind = i == 0 ? "video" : "audio";
+            tracks.push_back(media);
+        }
+        return true;
+    }
+
+    // Fetches every track fragment-parallel into <file>.<kind>.part, then
+    // lets ffmpeg mux them (stream copy) into the final .mp4. limit is the
+    // caller's bandwidth reservation; it goes back once the fragments are in.
+    bool fetchStream(const std::string& url, const std::string& filename, curl_off_t limit, uintmax_t& bytes,
+                     std::string& error) {
+        BandwidthScheduler& bandwidth = BandwidthScheduler::instance();
+        std::vector<StreamTrack> tracks;
+        if (!streamTracks(url, tracks, error)) {
+            bandwidth.unreserve(TrafficClass::Video, limit);
+            return false;
+        }
+
+        curl_off_t perTransfer = limit / static_cast<curl_off_t>(hostJobs);
+        FragmentFetcher fetcher(hostJobs, limit > 0 ? std::max<curl_off_t>(perTransfer, 1) : 0);
+        ProgressBoard& board = progress();
+        size_t id = board.begin();
+        std::vector<std::string> parts;
+        bool ok = true;
+        for (const StreamTrack& track : tracks) {
+            std::string part = filename + "." + track.kind + ".part";
+            parts.push_back(part);
+            int fd = open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                error = "Gagal buka file: " + part;
+                ok = false;
+                break;
+            }
+            log("Stream " + track.kind + ": " + std::to_string(track.fragments.size()) + " fragmen", LogLevel::Yt);
+            FileSink sink(fd, -1, 0);
+            ok = fetcher.run(track.fragments, [&](const std::string& body) {
+                bytes += body.size();
+                board.update(id, {static_cast<double>(bytes), 0, 0, -1});
+                return sink.write(body.data(), body.size());
+            }, error);
+            if (!sink.finish() && ok) {
+                error = "Gagal tulis ke " + part;
+                ok = false;
+            }
+            close(fd);
+            if (!ok) break;
+        }
+        board.end(id);
+        bandwidth.unreserve(TrafficClass::Video, limit);
+
+        if (ok) {
+            std::string muxed = filename + ".mux.mp4";
+            std::vector<std::string> args = {ffmpeg(), "-y", "-loglevel", "error"};
+            for (const auto& part : parts) args.insert(args.end(), {"-i", part});
+            for (size_t i = 0; i < parts.size(); i++) args.insert(args.end(), {"-map", std::to_string(i)});
+            args.insert(args.end(), {"-c", "copy", muxed});
+            int code = ProcessRunner::instance().run(args, [this](const std::string& line, bool) {
+                log("ffmpeg: " + line, LogLevel::Warn);
+            });
+            std::error_code ec;
+            if (code == 0) fs::rename(muxed, filename, ec);
+            if (code != 0 || ec) {
+                error = code != 0 ? "ffmpeg gagal (exit " + std::to_string(code) + ")" : "Gagal rename: " + ec.message();
+                fs::remove(muxed, ec);
+                ok = false;
+            }
+        }
+        std::error_code ec;
+        for (const auto& part : parts) fs::remove(part, ec);
+        return ok;
+    }
+
+    static std::string ytDlp() {
+        const char* bin = std::getenv("CYBERFETCH_YTDLP");
+        return bin && *bin ? bin : "yt-dlp";
+    }
+
+    // Second stage of a job whose yt-dlp run only fetches: the sources are
+    // the files starting with `prefix`, and ffmpegArgs turns them into output.
+    struct Pipeline {
+        std::string prefix;
+        std::function<std::vector<std::string>(const std::vector<std::string>& sources, const std::string& output)>
+            ffmpegArgs;
+        std::function<void()> fetched;
+        std::function<void()> started;
+    };
+
+    static std::vector<std::string> stageFiles(const std::string& prefix) {
+        fs::path base(prefix);
+        fs::path dir = base.parent_path().empty() ? fs::path(".") : base.parent_path();
+        std::string stem = base.filename().string();
+        std::vector<std::string> files;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(dir, ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.rfind(stem, 0) != 0) continue;
+            std::string ext = entry.path().extension().string();
+            if (ext == ".part" || ext == ".ytdl" || ext == ".temp") continue;
+            files.push_back(entry.path().string());
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    TaskGate& cpu() {
+        std::lock_guard<std::mutex> lock(stageMutex);
+        if (!cpuGate) cpuGate = std::make_unique<TaskGate>(cpuJobs);
+        return *cpuGate;
+    }
+
+    // Queues an ffmpeg run on the CPU stage. The queue in front of it holds
+    // cpuJobs items; past that, a job keeps its network slot until its
+    // transcode starts, so a slow CPU throttles fetching instead of piling
+    // sources up on disk.
+    void transcode(const std::vector<std::string>& args, const std::string& tmp, const std::string& filename,
+                   const std::vector<std::string>& sources, std::function<void(bool)> complete,
+                   std::function<void()> fetched) {
+        bool hold = cpuWaiting.fetch_add(1) >= cpuJobs;
+        cpu().submit([this, args, tmp, filename, sources, complete, fetched, hold](std::function<void()> release) {
+            cpuWaiting--;
+            if (hold && fetched) fetched();
+            auto onLine = [this](const std::string& line, bool) { log("ffmpeg: " + line, LogLevel::Warn); };
+            auto onExit = [tmp, filename, sources, complete, release](int code) {
+                std::error_code ec;
+                bool ok = code == 0;
+                if (ok) fs::rename(tmp, filename, ec);
+                if (!ok || ec) fs::remove(tmp, ec);
+                ok = ok && !ec;
+                for (const auto& source : sources) fs::remove(source, ec);
+                // Report before giving the slot back so wait() covers done.
+                complete(ok);
+                release();
+            };
+            if (!ProcessRunner::instance().spawn(args, onLine, onExit)) {
+                log("Failed to open ffmpeg process", LogLevel::Err);
+                complete(false);
+                release();
+            }
+        });
+        if (!hold && fetched) fetched();
+    }
+
+    // Runs one yt-dlp child on the shared ProcessRunner and reports through
+    // done. With a pipeline the child only fetches and ffmpeg finishes the
+    // job on the CPU stage. Under --max-rate the spawn waits in the
+    // scheduler's queue until a share is free.
+    void runYtDlp(const std::vector<std::string>& args, const std::string& label,
+                  const std::vector<std::string>& markers, const std::string& filename,
+                  const std::string& cacheKey, std::function<void(const DownloadResult&)> done,
+                  Pipeline pipeline = {}) {
+        TrafficClass traffic = label == "Video" ? TrafficClass::Video : TrafficClass::Audio;
+        BandwidthScheduler::instance().reserve(traffic, [=](curl_off_t limit) {
+            if (pipeline.started) pipeline.started();
+            spawnYtDlp(args, label, markers, filename, cacheKey, done, pipeline, traffic, limit);
+        });
+    }
+
+    void spawnYtDlp(const std::vector<std::string>& args, const std::string& label,
+                    const std::vector<std::string>& markers, const std::string& filename,
+                    const std::string& cacheKey, std::function<void(const DownloadResult&)> done,
+                    const Pipeline& pipeline, TrafficClass traffic, curl_off_t limit) {
+        std::string what = label;
+        what[0] = static_cast<char>(std::tolower(static_cast<unsigned char>(what[0])));
+        ProgressBoard& board = progress();
+        size_t id = board.begin();
+        std::vector<std::string> argv = args;
+        argv.insert(argv.begin() + 1, {"--newline", "--progress-template", ProgressBoard::progressTemplate()});
+        if (limit > 0) argv.insert(argv.begin() + 1, {"--limit-rate", std::to_string(limit)});
+        auto onLine = [this, markers, &board, id](const std::string& line, bool isErr) {
+            ProgressBoard::State state;
+            if (!isErr && ProgressBoard::parse(line, state)) {
+                board.update(id, state);
+                return;
+            }
+            if (isErr && line.rfind("ERROR", 0) == 0) {
+                log(line, LogLevel::Err);
+                return;
+            }
+            for (const auto& m : markers) {
+                if (line.find(m) != std::string::npos) {
+                    log(line, LogLevel::Warn);
+                    return;
+                }
+            }
+        };
+        auto started = std::chrono::steady_clock::now();
+        auto complete = [this, label, what, filename, cacheKey, done, started, url = args.back()](bool ok) {
+            JobMetrics job;
+            job.mode = what;
+            job.host = urlHost(url);
+            job.result = ok ? "ok" : "failed";
+            job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            std::error_code ec;
+            if (ok) job.bytes = fs::file_size(filename, ec);
+            metrics.record(job);
+            DownloadResult result;
+            if (!ok) {
+                log("Gagal download " + what, LogLevel::Err);
+                if (done) done(finish(result, false, filename));
+                return;
+            }
+            // Keep hashing off the supervisor thread.
+            auto store = [this, label, filename, cacheKey, done] {
+                DownloadResult stored;
+                if (cache) cache->store(cacheKey, filename);
+                log(label + " disimpan ke " + filename, LogLevel::Ok);
+                if (done) done(finish(stored, true, filename));
+            };
+            if (cache) cacheWorkers().submit(store);
+            else store();
+        };
+        auto onExit = [this, filename, complete, pipeline, &board, id, traffic, limit](int exitCode) {
+            board.end(id);
+            BandwidthScheduler::instance().unreserve(traffic, limit);
+            std::vector<std::string> sources;
+            if (exitCode == 0 && pipeline.ffmpegArgs) sources = stageFiles(pipeline.prefix);
+            if (exitCode != 0 || !pipeline.ffmpegArgs || sources.empty()) {
+                if (pipeline.fetched) pipeline.fetched();
+                complete(exitCode == 0 && (!pipeline.ffmpegArgs || !sources.empty()));
+                return;
+            }
+            std::string ext = fs::path(filename).extension().string();
+            std::string tmp = fs::path(filename).replace_extension(".ffmpeg" + ext).string();
+            transcode(pipeline.ffmpegArgs(sources, tmp), tmp, filename, sources, complete, pipeline.fetched);
+        };
+        if (!ProcessRunner::instance().spawn(argv, onLine, onExit)) {
+            board.end(id);
+            BandwidthScheduler::instance().unreserve(traffic, limit);
+            log("Failed to open yt-dlp process", LogLevel::Err);
+            if (pipeline.fetched) pipeline.fetched();
+            complete(false);
+        }
+    }
+
+    // yt-dlp gate order: audio before video.
+    static int jobPriority(const Job& job) { return job.mode == "--audio" ? 0 : 1; }
+
+    // Playlist/channel URLs are fanned out into per-item jobs instead of one
+    // yt-dlp process walking the whole list. The markers are YouTube's URL
+    // layout; on other sites yt-dlp handles whatever the URL turns out to be.
+    static bool isCollectionUrl(const std::string& url) {
+        std::string host = urlHost(url);
+        std::transform(host.begin(), host.end(), host.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        const std::string domain = ".youtube.com";
+        bool youtube = host == "youtu.be" || host == "youtube.com" ||
+                       (host.size() > domain.size() && host.compare(host.size() - domain.size(), domain.size(), domain) == 0);
+        if (!youtube) return false;
+        for (const char* marker : {"list=", "/playlist", "/channel/", "/c/", "/user/", "/@"})
+            if (url.find(marker) != std::string::npos) return true;
+        return false;
+    }
+
+    static std::string safeName(const std::string& id) {
+        std::string name;
+        for (char c : id)
+            name += (std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_') ? c : '_';
+        return name;
+    }
+
+    // Bookkeeping for a job made of many items (a playlist's entries, a
+    // page's images). The container holds one count of its own while it
+    // queues items; itemDone reports each item, and once the last count is
+    // settled `report` logs the summary and done gets the aggregate. A
+    // container that fails outright settles as one failed item, for callers
+    // that only tally items.
+    struct ItemTally {
+        enum Count { Item, Skipped, Container };
+
+        std::mutex mtx;
+        size_t remaining = 1;
+        size_t ok = 0;
+        size_t failed = 0;
+        size_t skipped = 0;
+        uintmax_t bytes = 0;
+        std::string path;
+        std::function<void(const DownloadResult&)> itemDone;
+        std::function<void(const DownloadResult&)> done;
+        std::function<void(const ItemTally&, bool ok)> report;
+
+        void expect(size_t items) {
+            std::lock_guard<std::mutex> lock(mtx);
+            remaining += items;
+        }
+
+        void settle(const DownloadResult& r, Count count) {
+            if (count != Container && itemDone) itemDone(r);
+            DownloadResult total;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (count == Skipped) skipped++;
+                else if (count == Item && r.ok) ok++;
+                else if (count == Item) failed++;
+                bytes += r.bytes;
+                if (--remaining > 0) return;
+                total.ok = failed == 0;
+                total.bytes = bytes;
+                total.file = path;
+            }
+            report(*this, total.ok);
+            if (done) done(total);
+        }
+    };
+
+    // Lists a playlist/channel with yt-dlp --flat-playlist and queues every
+    // entry on the gate as its own job, named after the item id so a rerun
+    // skips what is already there. itemDone reports each item; done gets the
+    // aggregate once all of them have finished.
+    void runPlaylistAsync(const Job& job, TaskGate& gate, std::function<void(const DownloadResult&)> itemDone,
+                          std::function<void(const DownloadResult&)> done) {
+        auto tally = std::make_shared<ItemTally>();
+        tally->path = ensureDir(job.path.empty() ? "downloaded" : job.path);
+        tally->itemDone = std::move(itemDone);
+        tally->done = std::move(done);
+        tally->report = [this, url = job.url](const ItemTally& t, bool ok) {
+            log("Playlist " + url + " selesai: " + std::to_string(t.ok) + " sukses, " + std::to_string(t.failed) +
+                " gagal, " + std::to_string(t.skipped) + " sudah ada", ok ? LogLevel::Ok : LogLevel::Warn);
+        };
+        gate.submit([this, job, &gate, tally](std::function<void()> release) {
+            log("Ambil daftar playlist " + job.url, LogLevel::Yt);
+            auto lines = std::make_shared<std::vector<std::string>>();
+            auto onLine = [this, lines](const std::string& line, bool isErr) {
+                if (!isErr) lines->push_back(line);
+                else if (line.rfind("ERROR", 0) == 0) log(line, LogLevel::Err);
+            };
+            auto onExit = [this, job, &gate, tally, lines, release](int code) {
+                std::vector<Job> items;
+                for (const auto& line : *lines) {
+                    std::string id = jsonString(line, "id");
+                    std::string url = jsonString(line, "url");
+                    if (url.empty()) url = jsonString(line, "webpage_url");
+                    if (id.empty() || url.empty()) continue;
+                    Job item = job;
+                    item.url = url;
+                    item.name = safeName(id);
+                    items.push_back(item);
+                }
+                if (code != 0 || items.empty()) {
+                    log("Gagal ambil daftar playlist " + job.url, LogLevel::Err);
+                    tally->settle(DownloadResult(), ItemTally::Item);
+                    release();
+                    return;
+                }
+                log("Playlist " + job.url + ": " + std::to_string(items.size()) + " item", LogLevel::System);
+
+                tally->expect(items.size());
+                std::string ext = job.mode == "--audio" ? ".mp3" : ".mp4";
+                for (const Job& item : items) {
+                    std::string filename = tally->path + item.name + ext;
+                    if (fs::exists(filename)) {
+                        log("Sudah ada, dilewati: " + filename, LogLevel::Info);
+                        DownloadResult present;
+                        tally->settle(finish(present, true, filename), ItemTally::Skipped);
+                        continue;
+                    }
+                    runGated(gate, item, [tally](const DownloadResult& r) { tally->settle(r, ItemTally::Item); });
+                }
+                tally->settle(DownloadResult(), ItemTally::Container);
+                // Items are queued before the listing gives up its slot, so wait() can't slip between.
+                release();
+            };
+            if (!ProcessRunner::instance().spawn({ytDlp(), "--flat-playlist", "--dump-json", job.url}, onLine, onExit)) {
+                log("Failed to open yt-dlp process", LogLevel::Err);
+                tally->settle(DownloadResult(), ItemTally::Item);
+                release();
+            }
+        }, jobPriority(job), urlHost(job.url));
+    }
+
+    // Waits out everything a batch or the daemon may have queued, upstream
+    // stages first since they keep feeding the ones after them.
+    void drainAll(TaskGate& ytGate) {
+        ytGate.wait();
+        cpu().wait();
+        // Pages are still handing images to the engine until their worker is done.
+        if (streamPool) streamPool->wait();
+        images().wait();
+        if (cachePool) cachePool->wait();
+    }
+
+    // Blocking playlist run for the single-job CLI modes.
+    void runPlaylist(const Job& job, size_t ytJobs) {
+        TaskGate gate(ytJobs, hostJobs);
+        runPlaylistAsync(job, gate, nullptr, nullptr);
+        gate.wait();
+        cpu().wait();
+        if (cachePool) cachePool->wait();
+    }
+
+    // fetched fires once the network part of a video/audio job is over (before
+    // its ffmpeg stage); other modes report only through done. started fires
+    // when the job really begins, after any wait for a bandwidth share.
+    void runJobAsync(const Job& job, std::function<void(const DownloadResult&)> done,
+                     std::function<void()> fetched = nullptr, std::function<void()> started = nullptr) {
+        if (job.mode == "--stream") {
+            downloadStreamAsync(job.url, job.path, done, job.name, started);
+            return;
+        }
+        if (job.mode == "--video") {
+            downloadVideoAsync(job.url, job.quality, job.path, done, job.name, fetched, started);
+            return;
+        }
+        if (job.mode == "--audio") {
+            downloadAudioAsync(job.url, job.path, done, job.name, fetched, started);
+            return;
+        }
+        if (started) started();
+        if (job.mode == "--page") downloadPageAsync(job.url, job.path, nullptr, done);
+        else downloadImageAsync(job.url, job.path, done, job.name);
+    }
+
+    // Runs a job on the yt-dlp gate. Its slot goes back as soon as the
+    // network stage is over, so the next fetch overlaps this job's ffmpeg run.
+    void runGated(TaskGate& gate, const Job& job, std::function<void(const DownloadResult&)> done,
+                  std::function<void()> started = nullptr) {
+        gate.submit([this, job, done, started](std::function<void()> release) {
+            auto once = std::make_shared<std::once_flag>();
+            auto free = [once, release] { std::call_once(*once, release); };
+            runJobAsync(job, [done, free](const DownloadResult& r) {
+                if (done) done(r);
+                free();
+            }, free, started);
+        }, jobPriority(job), urlHost(job.url));
+    }
 
 public:
     void showHelp(const std::string& name) {
         std::cout << "\033[1;36mUsage:\033[0m\n"
                   << "  " << name << " --video <url> [res] [path]\n"
                   << "  " << name << " --audio <url> [path]\n"
-                  << "  " << name << " --image <url> [path]\n"
-                  << "  " << name << " --help\n";
+                  << "  " << name << " --image <url> [path] [--segments N]\n"
+                  << "  " << name << " --stream <m3u8/mpd url> [path] [--host-jobs N]\n"
+                  << "  " << name << " --page <page url> [path] [--curl-jobs N] [--host-jobs N]\n"
+                  << "  " << name << " --batch <file> [--curl-jobs N] [--host-jobs N] [--yt-jobs N] [--segments N]\n"
+                  << "  " << name << " --daemon <socket> [--journal <file>] [batch options]\n"
+                  << "  " << name << " --client <socket> add <job args...> | status [id] | shutdown\n"
+                  << "  " << name << " --help\n"
+                  << "Options: --cache-dir <dir> reuse earlier downloads (304 revalidation for images)\n"
+                  << "         --log-json <file> append logs as JSON lines\n"
+                  << "         --metrics-json <file> / --metrics-prom <file> write per-job timing metrics\n"
+                  << "         --direct-io write image files with O_DIRECT (bypass the page cache)\n"
+                  << "         --max-rate <rate> cap total bandwidth, e.g. 2M (images get the largest share)\n"
+                  << "         --cpu-jobs N parallel ffmpeg runs for video/audio (default: CPU cores)\n"
+                  << "         --hedge P duplicate an image request with no response by the P-th percentile\n"
+                  << "                   first-byte time (e.g. 95); --mirrors <file> sends duplicates to mirrors\n";
     }
 
-    void downloadVideo(const std::string& url, const std::string& quality, const std::string& savePath) {
+    void downloadVideoAsync(const std::string& url, const std::string& quality, const std::string& savePath,
+                            std::function<void(const DownloadResult&)> done, const std::string& name = "",
+                            std::function<void()> fetched = nullptr, std::function<void()> started = nullptr) {
+        DownloadResult result;
         std::string res = quality.empty() ? "720" : quality;
         std::string path = ensureDir(savePath.empty() ? "downloaded" : savePath);
-        log("Savepath confirmed " + path, "System");
-        std::string filename = path + generateUUID() + ".mp4";
-
-        log("Download video " + url, "YT");
-        std::string cmd = 
-    "yt-dlp -f \"bv*[height<=" + res + "]+ba/b[height<=" + res + "]\" "
-    "--merge-output-format mp4 "
-    "-o \"" + filename + "\" \"" + url + "\"";
-        FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
-        log("Failed to open yt-dlp process", "ERR");
-        return;
-    }
-
-    char buffer[512];
-    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-        std::string line(buffer);
-        if (line.find("[download]") != std::string::npos ||
-            line.find("Destination") != std::string::npos ||
-            line.find("Merging") != std::string::npos) {
-            log(line, "WARN");
+        log("Savepath confirmed " + path, LogLevel::Info);
+        std::string base = name.empty() ? generateUUID() : name;
+        std::string filename = path + base + ".mp4";
+        std::string cacheKey = "video:" + res + ":" + url;
+        if (fromCache("video", url, cacheKey, filename)) {
+            if (done) done(finish(result, true, filename));
+            return;
         }
+
+        // yt-dlp only fetches the streams (",": separate files, audio ones get
+        // vcodec "none"); the remux runs on the CPU stage.
+        Pipeline pipeline;
+        pipeline.prefix = path + base + ".src.";
+        pipeline.fetched = fetched;
+        pipeline.started = started;
+        pipeline.ffmpegArgs = [this](const std::vector<std::string>& sources, const std::string& output) {
+            std::string video, audio;
+            for (const auto& source : sources) {
+                bool audioOnly = fs::path(source).filename().string().find(".none.") != std::string::npos;
+                std::string& slot = audioOnly ? audio : video;
+                if (slot.empty()) slot = source;
+            }
+            if (video.empty()) video = sources.front();
+            std::vector<std::string> args = {ffmpeg(), "-y", "-loglevel", "error", "-i", video};
+            if (!audio.empty() && audio != video)
+                args.insert(args.end(), {"-i", audio, "-map", "0:v:0", "-map", "1:a:0"});
+            args.insert(args.end(), {"-c", "copy", output});
+            return args;
+        };
+        log("Download video " + url, LogLevel::Yt);
+        runYtDlp({ytDlp(), "-f", "bv*[height<=" + res + "],ba/b[height<=" + res + "]", "--no-playlist",
+                  "-o", pipeline.prefix + "%(vcodec)s.%(format_id)s.%(ext)s", url},
+                 "Video", {"Destination"}, filename, cacheKey, done, pipeline);
     }
 
-    int exitCode = pclose(pipe);
-    std::cout << exitCode;
-    if (exitCode == 0) log("Video disimpan ke " + filename, "OK");
-    else log("Gagal download video", "ERR");
+    DownloadResult downloadVideo(const std::string& url, const std::string& quality, const std::string& savePath) {
+        std::promise<DownloadResult> promise;
+        auto future = promise.get_future();
+        downloadVideoAsync(url, quality, savePath, [&promise](const DownloadResult& r) { promise.set_value(r); });
+        DownloadResult result = future.get();
+        // done fires just before the ffmpeg slot is handed back.
+        cpu().wait();
+        return result;
     }
     
     void showWelcome() {
@@ -113,98 +4163,593 @@ public:
     std::cout << "\033[0m"; 
 }
 
-    void downloadAudio(const std::string& url, const std::string& savePath) {
+    void downloadAudioAsync(const std::string& url, const std::string& savePath,
+                            std::function<void(const DownloadResult&)> done, const std::string& name = "",
+                            std::function<void()> fetched = nullptr, std::function<void()> started = nullptr) {
+        DownloadResult result;
         std::string path = ensureDir(savePath.empty() ? "downloaded" : savePath);
-        std::string filename = path + generateUUID() + ".mp3";
-        log("Savepath confirmed " + path, "System");
-        log("Download audio " + url, "YT");
-        std::string cmd = "yt-dlp -x --audio-format mp3 -o \"" + filename + "\" \"" + url + "\"";
-
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
-        log("Failed to open yt_dlp process", "ERR");
-        return;
+        std::string base = name.empty() ? generateUUID() : name;
+        std::string filename = path + base + ".mp3";
+        log("Savepath confirmed " + path, LogLevel::Info);
+        std::string cacheKey = "audio:" + url;
+        if (fromCache("audio", url, cacheKey, filename)) {
+            if (done) done(finish(result, true, filename));
+            return;
+        }
+        // Fetch the best audio as-is; the mp3 encode runs on the CPU stage.
+        Pipeline pipeline;
+        pipeline.prefix = path + base + ".src.";
+        pipeline.fetched = fetched;
+        pipeline.started = started;
+        pipeline.ffmpegArgs = [this](const std::vector<std::string>& sources, const std::string& output) {
+            return std::vector<std::string>{ffmpeg(), "-y", "-loglevel", "error", "-i", sources.front(), "-vn",
+                                            "-c:a", "libmp3lame", "-q:a", "5", output};
+        };
+        log("Download audio " + url, LogLevel::Yt);
+        runYtDlp({ytDlp(), "-f", "ba/b", "--no-playlist", "-o", pipeline.prefix + "%(format_id)s.%(ext)s", url},
+                 "Audio", {"Destination"}, filename, cacheKey, done, pipeline);
     }
 
-    char buffer[512];
-    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-        std::string line(buffer);
-        if (line.find("[download]") != std::string::npos ||
-            line.find("Destination") != std::string::npos ||
-            line.find("Extracting") != std::string::npos) {
-            log(line, "WARN");
-        }
+    DownloadResult downloadAudio(const std::string& url, const std::string& savePath) {
+        std::promise<DownloadResult> promise;
+        auto future = promise.get_future();
+        downloadAudioAsync(url, savePath, [&promise](const DownloadResult& r) { promise.set_value(r); });
+        DownloadResult result = future.get();
+        // done fires just before the ffmpeg slot is handed back.
+        cpu().wait();
+        return result;
     }
 
-    int exitCode = pclose(pipe);
-    if (exitCode == 0) log("Audio disimpan ke " + filename, "OK");
-    else log("Gagal download audio", "ERR");
+    // Native HLS/DASH path: fragments come in parallel over the shared
+    // connection pool instead of yt-dlp's own connections.
+    void downloadStreamAsync(const std::string& url, const std::string& savePath,
+                             std::function<void(const DownloadResult&)> done, const std::string& name = "",
+                             std::function<void()> started = nullptr) {
+        std::string path = ensureDir(savePath.empty() ? "downloaded" : savePath);
+        std::string filename = path + (name.empty() ? generateUUID() : name) + ".mp4";
+        log("Download stream " + url, LogLevel::Yt);
+        // Under --max-rate the stream waits for its share in the scheduler's
+        // queue, not on a worker thread.
+        BandwidthScheduler::instance().reserve(TrafficClass::Video, [this, url, filename, done, started](curl_off_t limit) {
+            if (started) started();
+            streamWorkers().submit([this, url, filename, done, limit] {
+                auto began = std::chrono::steady_clock::now();
+                uintmax_t bytes = 0;
+                std::string error;
+                bool ok = fetchStream(url, filename, limit, bytes, error);
+                JobMetrics job;
+                job.mode = "stream";
+                job.host = urlHost(url);
+                job.result = ok ? "ok" : "failed";
+                job.bytes = bytes;
+                job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+                metrics.record(job);
+                if (ok) log("Stream disimpan ke " + filename, LogLevel::Ok);
+                else log("Gagal download stream " + url + ": " + error, LogLevel::Err);
+                DownloadResult result;
+                if (done) done(finish(result, ok, filename));
+            });
+        });
+    }
+
+    DownloadResult downloadStream(const std::string& url, const std::string& savePath) {
+        std::promise<DownloadResult> promise;
+        auto future = promise.get_future();
+        downloadStreamAsync(url, savePath, [&promise](const DownloadResult& r) { promise.set_value(r); });
+        return future.get();
     }
 
-    void downloadImage(const std::string& url, const std::string& savePath) {
+    void downloadImageAsync(const std::string& url, const std::string& savePath,
+                            std::function<void(const DownloadResult&)> done, const std::string& name = "") {
         std::string path = ensureDir(savePath.empty() ? "downloaded" : savePath);
-        std::string filename = path + generateUUID() + ".jpg";
+        std::string filename = path + (name.empty() ? generateUUID() : name) + ".jpg";
 
         log("Download gambar " + url);
-        CURL* curl = curl_easy_init();
-        if (!curl) {
-            log("Init CURL gagal", "ERR");
+        ImageTask task;
+        task.url = url;
+        task.filename = filename;
+        task.partname = path + urlKey(url) + ".part";
+        task.detectType = true;
+        DownloadCache::Entry cached;
+        bool hit = cache && cache->lookup(url, cached);
+        if (hit) {
+            task.etag = cached.etag;
+            task.modified = cached.modified;
+        }
+        task.done = [this, url, done, hit, cached, filename](const FetchResult& fetched) mutable {
+            JobMetrics job;
+            job.mode = "image";
+            job.host = urlHost(url);
+            job.result = !fetched.ok ? "failed" : fetched.notModified ? "not_modified" : "ok";
+            job.bytes = fetched.bytes;
+            job.seconds = fetched.seconds;
+            job.hasTimes = fetched.hasTimes;
+            job.times = fetched.times;
+            job.hedged = fetched.hedged;
+            job.hedgeWon = fetched.hedgeWon;
+            metrics.record(job);
+
+            DownloadResult result;
+            bool ok = fetched.ok;
+            if (ok && !fetched.notModified) filename = fetched.filename;
+            if (ok && fetched.notModified) {
+                ok = hit && cache->link(cached.hash, filename);
+                if (ok) {
+                    std::string typed = fs::path(filename).replace_extension(imageExtension(fileHead(filename), ""));
+                    std::error_code ec;
+                    if (typed != filename) fs::rename(filename, typed, ec);
+                    if (typed != filename && !ec) filename = typed;
+                }
+                if (ok) log("Gambar belum berubah (304), ambil dari cache: " + filename, LogLevel::Ok);
+                else log("Gagal ambil gambar dari cache " + url, LogLevel::Err);
+            } else if (ok && cache) {
+                // Hashing big files would stall the engine loop, so it runs on the cache pool.
+                cacheWorkers().submit([this, url, filename, done, fetched] {
+                    DownloadResult stored;
+                    cache->store(url, filename, fetched.etag, fetched.modified);
+                    log("Gambar disimpan ke " + filename, LogLevel::Ok);
+                    finish(stored, true, filename);
+                    if (done) done(stored);
+                });
+                return;
+            } else if (ok) {
+                log("Gambar disimpan ke " + filename, LogLevel::Ok);
+            } else {
+                log("Gagal download gambar " + url + ": " + fetched.error, LogLevel::Err);
+            }
+            finish(result, ok, filename);
+            if (done) done(result);
+        };
+        images().add(std::move(task));
+    }
+
+    DownloadResult downloadImage(const std::string& url, const std::string& savePath) {
+        std::promise<DownloadResult> promise;
+        auto future = promise.get_future();
+        downloadImageAsync(url, savePath, [&promise](const DownloadResult& r) { promise.set_value(r); });
+        return future.get();
+    }
+
+    // Page scraping: the page streams through PageScanner on a stream worker
+    // and every image it names goes to the curl engine right away, so image
+    // downloads overlap the rest of the page. itemDone reports each image;
+    // done gets the aggregate once the page and all its images are finished.
+    void downloadPageAsync(const std::string& url, const std::string& savePath,
+                           std::function<void(const DownloadResult&)> itemDone,
+                           std::function<void(const DownloadResult&)> done) {
+        auto tally = std::make_shared<ItemTally>();
+        tally->path = ensureDir(savePath.empty() ? "downloaded" : savePath);
+        tally->itemDone = std::move(itemDone);
+        tally->done = std::move(done);
+        tally->report = [this, url](const ItemTally& t, bool ok) {
+            log("Halaman " + url + " selesai: " + std::to_string(t.ok) + " gambar sukses, " +
+                std::to_string(t.failed) + " gagal", ok ? LogLevel::Ok : LogLevel::Warn);
+        };
+        // The engine is created here so the worker only ever adds to it.
+        images();
+        log("Scrape halaman " + url);
+        streamWorkers().submit([this, url, savePath, tally] {
+            size_t found = 0;
+            PageScanner scanner(url, [this, savePath, tally, &found](const std::string& image) {
+                found++;
+                tally->expect(1);
+                // Same folder string as a plain --image job, so both map to the same .part.
+                downloadImageAsync(image, savePath, [tally](const DownloadResult& r) {
+                    tally->settle(r, ItemTally::Item);
+                });
+            });
+            std::string finalUrl, error;
+            bool first = true;
+            FragmentFetcher::ChunkFn feed = [&scanner, &finalUrl, &first](const char* data, size_t len) {
+                if (first) scanner.rebase(finalUrl);
+                first = false;
+                scanner.feed(data, len);
+                return true;
+            };
+            DownloadResult page;
+            if (!FragmentFetcher::fetch(url, feed, finalUrl, error)) {
+                log("Gagal ambil halaman " + url + ": " + error, LogLevel::Err);
+                tally->settle(page, ItemTally::Item);
+                return;
+            }
+            if (found == 0) log("Nggak ada gambar di halaman " + url, LogLevel::Warn);
+            else log("Halaman " + url + ": " + std::to_string(found) + " gambar", LogLevel::System);
+            page.ok = true;
+            tally->settle(page, ItemTally::Container);
+        });
+    }
+
+    DownloadResult downloadPage(const std::string& url, const std::string& savePath) {
+        std::promise<DownloadResult> promise;
+        auto future = promise.get_future();
+        downloadPageAsync(url, savePath, nullptr, [&promise](const DownloadResult& r) { promise.set_value(r); });
+        return future.get();
+    }
+
+    // One line per origin: "<url prefix> <mirror prefix>...", '#' for comments.
+    bool loadMirrors(const std::string& file) {
+        std::ifstream in(file);
+        if (!in) {
+            log("Gagal baca file mirror: " + file, LogLevel::Err);
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream words(line);
+            std::string prefix, mirror;
+            if (!(words >> prefix) || prefix[0] == '#') continue;
+            std::vector<std::string> targets;
+            while (words >> mirror) targets.push_back(mirror);
+            if (!targets.empty()) mirrors.emplace_back(prefix, targets);
+        }
+        return true;
+    }
+
+    void reportTail() {
+        MetricsRegistry::Tail tail = metrics.tail("image");
+        if (tail.count == 0) return;
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3) << "Latensi gambar (" << tail.count << " job): p50 " << tail.p50
+            << "s, p90 " << tail.p90 << "s, p99 " << tail.p99 << "s, max " << tail.max << "s";
+        if (tail.timed) out << " | TTFB p50 " << tail.ttfb50 << "s, p99 " << tail.ttfb99 << "s";
+        if (hedgePercentile > 0) out << " | hedge " << tail.hedged << " (menang " << tail.hedgeWon << ")";
+        log(out.str(), LogLevel::System);
+    }
+
+    void writeMetrics() {
+        if (!metricsJson.empty()) {
+            if (metrics.writeJson(metricsJson)) log("Metrics JSON ditulis ke " + metricsJson, LogLevel::System);
+            else log("Gagal tulis metrics ke " + metricsJson, LogLevel::Err);
+        }
+        if (!metricsProm.empty()) {
+            if (metrics.writePrometheus(metricsProm)) log("Metrics Prometheus ditulis ke " + metricsProm, LogLevel::System);
+            else log("Gagal tulis metrics ke " + metricsProm, LogLevel::Err);
+        }
+    }
+
+    void runBatch(const std::string& file, size_t ytJobs) {
+        std::ifstream in(file);
+        if (!in) {
+            log("Gagal baca file batch: " + file, LogLevel::Err);
             return;
         }
 
-        FILE* fp = fopen(filename.c_str(), "wb");
-        if (!fp) {
-            log("Gagal buka file: " + filename, "ERR");
-            curl_easy_cleanup(curl);
+        std::vector<Job> jobs;
+        std::string line;
+        size_t lineNo = 0;
+        while (std::getline(in, line)) {
+            lineNo++;
+            std::istringstream ss(line);
+            std::vector<std::string> tokens;
+            std::string token;
+            while (ss >> token) tokens.push_back(token);
+            if (tokens.empty() || tokens[0][0] == '#') continue;
+
+            Job job;
+            if (parseJob(tokens, job)) jobs.push_back(job);
+            else log("Baris " + std::to_string(lineNo) + " nggak valid, dilewati", LogLevel::Warn);
+        }
+
+        log("Batch " + std::to_string(jobs.size()) + " job, curl=" + std::to_string(curlJobs) +
+            " (per host " + std::to_string(hostJobs) + ") yt-dlp=" + std::to_string(ytJobs) +
+            " ffmpeg=" + std::to_string(cpuJobs), LogLevel::System);
+
+        std::atomic<size_t> okCount{0}, failCount{0};
+        std::atomic<uintmax_t> totalBytes{0};
+        auto start = std::chrono::steady_clock::now();
+        auto record = [&okCount, &failCount, &totalBytes](const DownloadResult& r) {
+            if (r.ok) {
+                okCount++;
+                totalBytes += r.bytes;
+            } else {
+                failCount++;
+            }
+        };
+        // Images go out first and hold the larger bandwidth share; yt-dlp jobs
+        // start audio before video and respect the per-host limit too.
+        TaskGate ytGate(ytJobs, hostJobs);
+        for (const auto& job : jobs) {
+            if (job.mode == "--image") downloadImageAsync(job.url, job.path, record);
+            else if (job.mode == "--page") downloadPageAsync(job.url, job.path, record, nullptr);
+        }
+        for (const auto& job : jobs) {
+            if (job.mode == "--image" || job.mode == "--page") continue;
+            if (job.mode != "--stream" && isCollectionUrl(job.url)) {
+                runPlaylistAsync(job, ytGate, record, nullptr);
+                continue;
+            }
+            runGated(ytGate, job, record);
+        }
+        drainAll(ytGate);
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (secs <= 0) secs = 1e-9;
+
+        std::ostringstream summary;
+        summary << std::fixed << std::setprecision(2)
+                << "Batch selesai: " << okCount << " sukses, " << failCount << " gagal, "
+                << formatBytes(static_cast<double>(totalBytes)) << " dalam " << secs << "s ("
+                << formatBytes(totalBytes / secs) << "/s, " << (okCount + failCount) / secs << " job/s)";
+        log(summary.str(), failCount == 0 ? LogLevel::Ok : LogLevel::Warn);
+        ConnectionPool& pool = ConnectionPool::instance();
+        log("Koneksi: " + std::to_string(pool.newConnections()) + " baru, " +
+            std::to_string(pool.reusedConnections()) + " transfer pakai koneksi lama", LogLevel::System);
+    }
+
+    static bool unixAddress(const std::string& path, sockaddr_un& addr) {
+        if (path.size() >= sizeof(addr.sun_path)) return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    static std::vector<std::string> splitTabs(const std::string& line) {
+        std::vector<std::string> cols;
+        std::istringstream ss(line);
+        std::string col;
+        while (std::getline(ss, col, '\t')) cols.push_back(col);
+        return cols;
+    }
+
+    static bool readLine(int fd, std::string& line) {
+        char c;
+        while (true) {
+            ssize_t n = read(fd, &c, 1);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return !line.empty();
+            if (c == '\n') return true;
+            line += c;
+        }
+    }
+
+    static void sendAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    struct DaemonJob {
+        Job job;
+        std::string state;
+        uintmax_t bytes = 0;
+    };
+
+    // Serves one request per connection on a Unix socket, one tab-separated line:
+    //   add <job args...>  -> queued <id>
+    //   status [id]        -> <id> <state> <mode> <url> <bytes>, one per line
+    //   shutdown           -> stops accepting, finishes running jobs, exits
+    // Jobs go through the same engine and yt-dlp gate as a batch, so
+    // connections and workers stay warm between requests.
+    void runDaemon(const std::string& socketPath, const std::string& journalPath, size_t ytJobs) {
+        sockaddr_un addr;
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0 || !unixAddress(socketPath, addr)) {
+            log("Gagal buka socket " + socketPath, LogLevel::Err);
+            if (listener >= 0) close(listener);
+            return;
+        }
+        unlink(socketPath.c_str());
+        if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+            log("Gagal listen di " + socketPath + ": " + strerror(errno), LogLevel::Err);
+            close(listener);
             return;
         }
 
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeData);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+        JobJournal journal(journalPath);
+        uint64_t nextId = 1;
+        std::vector<JobJournal::Record> recovered = journal.recover(nextId);
+        if (!journal.isOpen()) log("Gagal buka journal " + journalPath + ", job nggak bakal disimpan", LogLevel::Warn);
+
+        std::mutex jobsMutex;
+        std::map<uint64_t, DaemonJob> jobs;
+        auto setState = [&jobsMutex, &jobs](uint64_t id, const std::string& state, uintmax_t bytes) {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs[id].state = state;
+            jobs[id].bytes = bytes;
+        };
+        TaskGate ytGate(ytJobs, hostJobs);
+        auto dispatch = [this, &journal, &ytGate, setState](uint64_t id, const Job& job) {
+            auto done = [&journal, setState, id](const DownloadResult& r) {
+                journal.finished(id, r.ok, r.bytes);
+                setState(id, r.ok ? "ok" : "failed", r.bytes);
+            };
+            if (job.mode == "--image" || job.mode == "--page") {
+                setState(id, "running", 0);
+                runJobAsync(job, done);
+                return;
+            }
+            if (job.mode != "--stream" && isCollectionUrl(job.url)) {
+                setState(id, "running", 0);
+                runPlaylistAsync(job, ytGate, nullptr, done);
+                return;
+            }
+            runGated(ytGate, job, done, [setState, id] { setState(id, "running", 0); });
+        };
+
+        for (const auto& r : recovered) {
+            {
+                std::lock_guard<std::mutex> lock(jobsMutex);
+                jobs[r.id] = {r.job, "queued", 0};
+            }
+            dispatch(r.id, r.job);
+        }
+        log("Daemon jalan di " + socketPath + ", " + std::to_string(recovered.size()) +
+            " job dilanjutkan dari " + journalPath, LogLevel::System);
+
+        bool stopping = false;
+        while (!stopping) {
+            int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR) continue;
+                log(std::string("Accept gagal: ") + strerror(errno), LogLevel::Err);
+                break;
+            }
+            // A stuck client must not hold up the daemon.
+            timeval timeout{5, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            std::string request;
+            readLine(client, request);
+            std::vector<std::string> tokens = splitTabs(request);
+            std::string command = tokens.empty() ? "" : tokens[0];
+            std::string reply;
+            if (command == "add") {
+                Job job;
+                if (!parseJob(std::vector<std::string>(tokens.begin() + 1, tokens.end()), job)) {
+                    reply = "error\tjob nggak valid\n";
+                } else {
+                    job.name = generateUUID();
+                    uint64_t id = nextId++;
+                    journal.added(id, job);
+                    {
+                        std::lock_guard<std::mutex> lock(jobsMutex);
+                        jobs[id] = {job, "queued", 0};
+                    }
+                    log("Job " + std::to_string(id) + " masuk: " + job.mode + " " + job.url, LogLevel::System);
+                    dispatch(id, job);
+                    reply = "queued\t" + std::to_string(id) + "\n";
+                }
+            } else if (command == "status") {
+                uint64_t only = tokens.size() > 1 ? std::strtoull(tokens[1].c_str(), nullptr, 10) : 0;
+                std::lock_guard<std::mutex> lock(jobsMutex);
+                for (const auto& entry : jobs) {
+                    if (only && entry.first != only) continue;
+                    const DaemonJob& j = entry.second;
+                    reply += std::to_string(entry.first) + "\t" + j.state + "\t" + j.job.mode + "\t" + j.job.url +
+                             "\t" + std::to_string(j.bytes) + "\n";
+                }
+            } else if (command == "shutdown") {
+                stopping = true;
+                reply = "bye\n";
+            } else {
+                reply = "error\tperintah nggak dikenal: " + command + "\n";
+            }
+            sendAll(client, reply);
+            close(client);
+        }
+        close(listener);
+        unlink(socketPath.c_str());
 
-        CURLcode res = curl_easy_perform(curl);
-        fclose(fp);
-        curl_easy_cleanup(curl);
+        log("Daemon berhenti, nunggu job yang masih jalan", LogLevel::System);
+        drainAll(ytGate);
+    }
 
-        if (res == CURLE_OK) log("Gambar disimpan ke " + filename, "OK");
-        else log("Gagal download gambar: " + std::string(curl_easy_strerror(res)), "ERR");
+    // Sends one command to a running daemon and prints its reply.
+    bool runClient(const std::string& socketPath, const std::vector<std::string>& command) {
+        sockaddr_un addr;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || !unixAddress(socketPath, addr) ||
+            connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::cerr << "Gagal konek ke daemon di " << socketPath << ": " << strerror(errno) << "\n";
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        std::vector<std::string> tokens = command;
+        Job job;
+        if (tokens.size() > 1 && tokens[0] == "add" &&
+            parseJob(std::vector<std::string>(tokens.begin() + 1, tokens.end()), job)) {
+            // The daemon has its own working directory; send the path as meant here.
+            std::error_code ec;
+            fs::path where = fs::absolute(job.path.empty() ? "downloaded" : job.path, ec);
+            tokens = {"add", job.mode, job.url};
+            if (job.mode == "--video") tokens.push_back(job.quality);
+            tokens.push_back(ec ? job.path : where.string());
+        }
+        std::string request;
+        for (size_t i = 0; i < tokens.size(); i++) request += (i ? "\t" : "") + tokens[i];
+        sendAll(fd, request + "\n");
+        shutdown(fd, SHUT_WR);
+        std::string reply;
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) reply.append(buf, static_cast<size_t>(n));
+        close(fd);
+        std::cout << reply;
+        return reply.rfind("error", 0) != 0;
     }
 
     void run(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    // Client commands are scripted; skip the banner.
+    if (args.size() >= 2 && args[0] == "--client") {
+        clientOk = runClient(args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+        return;
+    }
       showWelcome();
-    if (argc < 3 || std::string(argv[1]) == "--help") {
+    curlJobs = toCount(takeFlag(args, "--curl-jobs"), curlJobs);
+    hostJobs = toCount(takeFlag(args, "--host-jobs"), hostJobs);
+    segments = toCount(takeFlag(args, "--segments"), segments);
+    directIo = takeSwitch(args, "--direct-io");
+    BandwidthScheduler::instance().setRate(toRate(takeFlag(args, "--max-rate")));
+    size_t ytJobs = toCount(takeFlag(args, "--yt-jobs"), 3);
+    hedgePercentile = std::min(std::max(std::atof(takeFlag(args, "--hedge", "0").c_str()), 0.0), 99.9);
+    std::string mirrorFile = takeFlag(args, "--mirrors");
+    if (!mirrorFile.empty() && loadMirrors(mirrorFile) && hedgePercentile <= 0)
+        log("--mirrors cuma dipakai bareng --hedge", LogLevel::Warn);
+    cpuJobs = toCount(takeFlag(args, "--cpu-jobs"), cpuJobs);
+    std::string cacheDir = takeFlag(args, "--cache-dir");
+    std::string logJson = takeFlag(args, "--log-json");
+    metricsJson = takeFlag(args, "--metrics-json");
+    metricsProm = takeFlag(args, "--metrics-prom");
+    std::string journalPath = takeFlag(args, "--journal");
+    if (!logJson.empty()) logger.openJson(logJson);
+    if (!cacheDir.empty()) {
+        cache = std::make_unique<DownloadCache>(cacheDir);
+        cachePool = std::make_unique<WorkerPool>(2);
+    }
+
+    if (args.size() < 2 || args[0] == "--help") {
         showHelp(argv[0]);
         return;
     }
 
-    std::string mode = argv[1];
-    std::string url = argv[2];
+    std::string mode = args[0];
+    std::string url = args[1];
 
-    if (mode == "--video") {
-    if (argc < 5) {
-        log("All params are required, please see --help", "ERR");
+    if (mode == "--batch") {
+        runBatch(url, ytJobs);
+    } else if (mode == "--daemon") {
+        runDaemon(url, journalPath.empty() ? url + ".journal" : journalPath, ytJobs);
+    } else if (mode == "--video") {
+    if (args.size() < 4) {
+        log("All params are required, please see --help", LogLevel::Err);
         return;
     }
-       std::string quality = (argc > 3) ? argv[3] : "";
-        std::string path = (argc > 4) ? argv[4] : argv[3];
-        downloadVideo(url, quality, path);
+        if (isCollectionUrl(url)) runPlaylist({mode, url, args[2], args[3], ""}, ytJobs);
+        else downloadVideo(url, args[2], args[3]);
     } else if (mode == "--audio") {
-        std::string path = (argc > 3) ? argv[3] : "";
-        downloadAudio(url, path);
+        std::string path = (args.size() > 2) ? args[2] : "";
+        if (isCollectionUrl(url)) runPlaylist({mode, url, "", path, ""}, ytJobs);
+        else downloadAudio(url, path);
 
     } else if (mode == "--image") {
-        std::string path = (argc > 3) ? argv[3] : "";
+        std::string path = (args.size() > 2) ? args[2] : "";
         downloadImage(url, path);
 
+    } else if (mode == "--stream") {
+        std::string path = (args.size() > 2) ? args[2] : "";
+        downloadStream(url, path);
+
+    } else if (mode == "--page") {
+        std::string path = (args.size() > 2) ? args[2] : "";
+        downloadPage(url, path);
+
     } else {
-        log("Mode nggak valid. Gunakan --help buat liat cara pakai", "ERR");
+        log("Mode nggak valid. Gunakan --help buat liat cara pakai", LogLevel::Err);
     }
+    reportTail();
+    writeMetrics();
 }
+
+    bool clientFailed() const { return !clientOk; }
 };
 
 int main(int argc, char* argv[]) {
+    ConnectionPool::instance();
     Downloader d;
     d.run(argc, argv);
-    return 0;
+    return d.clientFailed() ? 1 : 0;
 }
\ No newline at end of file
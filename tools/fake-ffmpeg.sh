@@ -0,0 +1,9 @@
+#!/bin/sh
+# Stand-in for ffmpeg (CYBERFETCH_FFMPEG=tools/fake-ffmpeg.sh): concatenates
+# every -i input into the last argument, after $FAKE_FFMPEG_DELAY seconds
+# of "CPU" if set. Arguments are appended to $FAKE_LOG when it is set.
+[ -n "$FAKE_LOG" ] && echo "$@" >> "$FAKE_LOG"
+[ -n "$FAKE_FFMPEG_DELAY" ] && sleep "$FAKE_FFMPEG_DELAY"
+out=""; for a in "$@"; do out="$a"; done
+: > "$out"; prev=""
+for a in "$@"; do [ "$prev" = "-i" ] && cat "$a" >> "$out"; prev="$a"; done
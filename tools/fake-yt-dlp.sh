@@ -0,0 +1,30 @@
+#!/bin/sh
+# Stand-in for yt-dlp (CYBERFETCH_YTDLP=tools/fake-yt-dlp.sh), no network.
+#   --flat-playlist   prints six canned --dump-json entries; a URL
+#                     containing "broken" fails like an unknown channel
+#   -o <file>         sleeps 1 s of "network", writes a few bytes; -x and
+#                     --merge-output-format cost another 1 s of "CPU"
+#   -o '%(...)s'      split-format template: writes the video and audio
+#                     files the fetch/ffmpeg pipeline expects
+# Arguments are appended to $FAKE_LOG when it is set.
+[ -n "$FAKE_LOG" ] && echo "$@" >> "$FAKE_LOG"
+case "$*" in
+*--flat-playlist*)
+  case "$*" in *broken*) echo "ERROR: nope" >&2; exit 1;; esac
+  for i in 1 2 3 4 5 6; do
+    echo "{\"_type\": \"url\", \"ie_key\": \"Youtube\", \"id\": \"vid$i-x\", \"url\": \"https://www.youtube.com/watch?v=vid$i-x\", \"title\": \"Item \\\"$i\\\" {a}\", \"thumbnails\": [{\"url\": \"https://i.ytimg.com/$i.jpg\", \"id\": \"t$i\"}]}"
+  done
+  exit 0;;
+esac
+out=""; prev=""; fmt=""
+for a in "$@"; do [ "$prev" = "-o" ] && out="$a"; [ "$prev" = "-f" ] && fmt="$a"; prev="$a"; done
+sleep 1
+case "$out" in
+*"%("*)
+  case "$fmt" in
+  *,*) f=$(echo "$out" | sed 's/%(vcodec)s/avc1/;s/%(format_id)s/137/;s/%(ext)s/mp4/'); echo video > "$f"
+       f=$(echo "$out" | sed 's/%(vcodec)s/none/;s/%(format_id)s/140/;s/%(ext)s/m4a/'); echo audio > "$f";;
+  *) f=$(echo "$out" | sed 's/%(format_id)s/251/;s/%(ext)s/webm/'); echo audio > "$f";;
+  esac;;
+*) case "$*" in *-x*|*--merge-output*) sleep 1;; esac; echo data > "$out";;
+esac
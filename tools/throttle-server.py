@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# Local HTTP server for exercising the downloader without the internet.
+#   usage: throttle-server.py <port> <root dir> <bytes/s per connection, 0 = unthrottled>
+# Serves GET/HEAD with Range support. Environment knobs:
+#   NORANGE=1     ignore Range and answer 200 with the whole file
+#   ETAG=<tag>    send this ETag and answer a matching If-None-Match with 304
+#   STALL=<secs>  the first request for every 10th path (by CRC) stalls this
+#                 long before answering, like a slow origin connection
+import os, re, sys, time, zlib, socket, threading
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
+
+ROOT = sys.argv[2]
+RATE = int(sys.argv[3])
+STALL = float(os.environ.get("STALL", "0"))
+seen = {}
+lock = threading.Lock()
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def setup(self):
+        super().setup()
+        self.connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    def stall(self):
+        with lock:
+            n = seen.get(self.path, 0)
+            seen[self.path] = n + 1
+        if STALL and n == 0 and zlib.crc32(self.path.encode()) % 10 == 0:
+            time.sleep(STALL)
+
+    def send_body(self, head):
+        self.stall()
+        path = os.path.join(ROOT, self.path.lstrip("/").split("?")[0])
+        if not os.path.isfile(path):
+            self.send_response(404)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+        etag = os.environ.get("ETAG")
+        if etag and self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.end_headers()
+            return
+        norange = os.environ.get("NORANGE") is not None
+        size = os.path.getsize(path)
+        start, end, code = 0, size - 1, 200
+        wanted = self.headers.get("Range")
+        if wanted and not norange:
+            m = re.match(r"bytes=(\d+)-(\d*)", wanted)
+            start = int(m.group(1))
+            end = int(m.group(2)) if m.group(2) else size - 1
+            code = 206
+        self.send_response(code)
+        if not norange:
+            self.send_header("Accept-Ranges", "bytes")
+        if code == 206:
+            self.send_header("Content-Range", f"bytes {start}-{end}/{size}")
+        self.send_header("Content-Type", "image/png" if path.endswith(".png") else "application/octet-stream")
+        if etag:
+            self.send_header("ETag", etag)
+        self.send_header("Content-Length", str(end - start + 1))
+        self.end_headers()
+        if head:
+            return
+        with open(path, "rb") as f:
+            f.seek(start)
+            left = end - start + 1
+            while left > 0:
+                chunk = f.read(min(16384, left))
+                self.wfile.write(chunk)
+                left -= len(chunk)
+                if RATE:
+                    time.sleep(len(chunk) / RATE)
+
+    def do_GET(self):
+        self.send_body(False)
+
+    def do_HEAD(self):
+        self.send_body(True)
+
+ThreadingHTTPServer.daemon_threads = True
+ThreadingHTTPServer(("127.0.0.1", int(sys.argv[1])), Handler).serve_forever()